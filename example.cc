@@ -20,6 +20,11 @@ test_define(example, basic)
         test_gt(value, 29);
         test_le(value, 29);
         test_lt(value, 29);
+
+        // Or any expression, a top-level comparison
+        // gets both of its sides reported
+        test_check(value * 2 == 29);
+        test_check(value > 0 && value % 2 == 1);
     }
 
     test_section("containers")
@@ -64,4 +69,28 @@ test_define(example, custom)
 {
     MyType m { 123, 456.7f };
     test_eq(m, MyType { .integer = 123, .number = 456.7f });
-}
\ No newline at end of file
+}
+
+// Diffs stay minimal on large inputs, a few edits in megabytes
+// of text are reported as hunks of their own
+test_define(example, large_diff)
+{
+    std::string text;
+    for (std::uint32_t i = 0, state = 1; i < 3'000'000; i++)
+        text += char('a' + ((state = state * 1664525u + 1013904223u) >> 16) % 26);
+
+    std::string edited = text;
+    edited[100] = '#';
+    edited.insert(1'000'000, "XYZ");
+    edited.erase(2'000'000, 2);
+    edited[2'900'000] = '@';
+
+    const std::string diff = utest::diff(text, edited);
+    int hunks = 0;
+    for (std::size_t at = 0; (at = diff.find("\t@ ", at)) != std::string::npos; at++)
+        hunks++;
+    test_eq(hunks, 4);
+    test_check(diff.find("{+#+}") != std::string::npos);
+    test_check(diff.find("{+XYZ+}") != std::string::npos);
+    test_lt(diff.size(), 1000u);
+}
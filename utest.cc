@@ -3,18 +3,597 @@
 #include <fmt/format.h>
 #include <fmt/color.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define UTEST_POSIX
+#define UTEST_HAS_PROFILER
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/magic.h>
+#include <sys/vfs.h>
+#endif
+
 namespace utest
 {
+    // ---------------------------------------- STRING HELPERS
+
+    bool glob_match(std::string_view pattern, std::string_view text)
+    {
+        // Greedy matching with backtracking to the last '*'
+        std::size_t p = 0, t = 0;
+        std::size_t star = std::string_view::npos, retry = 0;
+        while (t < text.size())
+        {
+            if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t]))
+            {
+                p++;
+                t++;
+            }
+            else if (p < pattern.size() && pattern[p] == '*')
+            {
+                star = p++;
+                retry = t;
+            }
+            else if (star != std::string_view::npos)
+            {
+                p = star + 1;
+                t = ++retry;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*')
+            p++;
+        return p == pattern.size();
+    }
+
+    namespace
+    {
+        // "a,b,c" -> { "a", "b", "c" }, empty items are dropped
+        std::vector<std::string_view> split_list(std::string_view list)
+        {
+            std::vector<std::string_view> items;
+            while (!list.empty())
+            {
+                const std::size_t comma = std::min(list.find(','), list.size());
+                if (comma > 0)
+                    items.push_back(list.substr(0, comma));
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+            return items;
+        }
+
+        // 1234567 -> "1,234,567"
+        std::string group_thousands(long long value)
+        {
+            std::string digits = std::to_string(value < 0 ? -value : value);
+            std::string result = value < 0 ? "-" : "";
+            for (std::size_t i = 0; i < digits.size(); i++)
+            {
+                if (i > 0 && (digits.size() - i) % 3 == 0)
+                    result += ',';
+                result += digits[i];
+            }
+            return result;
+        }
+    }
+
+    // ---------------------------------------- TRACER
+
+    namespace
+    {
+        enum class trace_kind : char
+        {
+            fixture,
+            section
+        };
+
+        struct trace_event
+        {
+            const void* subject;
+            std::int64_t timestamp;
+            trace_kind kind;
+            char phase;
+        };
+
+        // Single producer ring buffer, only the owning thread writes to it and
+        // it is read once all fixtures are done; when full the oldest events
+        // are overwritten
+        struct trace_buffer
+        {
+            static constexpr std::size_t capacity = 1 << 16;
+            std::unique_ptr<trace_event[]> events = std::make_unique<trace_event[]>(capacity);
+            std::atomic<std::size_t> head = 0;
+            int thread_id = 0;
+
+            void push(const trace_event& event)
+            {
+                const std::size_t index = head.load(std::memory_order_relaxed);
+                events[index % capacity] = event;
+                head.store(index + 1, std::memory_order_release);
+            }
+        };
+
+        // One buffer per thread recording into it, a thread caches the buffer
+        // it used last; tracers are told apart by id as addresses get reused
+        struct tracer
+        {
+            static inline std::atomic<std::uint64_t> next_id = 1;
+            static inline const auto epoch = std::chrono::steady_clock::now();
+
+            const std::uint64_t id = next_id.fetch_add(1);
+            bool enabled = false;
+            std::mutex mutex;
+            std::vector<std::pair<std::thread::id, std::unique_ptr<trace_buffer>>> buffers = {};
+
+            trace_buffer& local()
+            {
+                thread_local std::pair<std::uint64_t, trace_buffer*> cached = {};
+                if (cached.first == id)
+                    return *cached.second;
+
+                std::lock_guard lock(mutex);
+                const auto thread = std::this_thread::get_id();
+                auto it = std::find_if(buffers.begin(), buffers.end(), [&](const auto& buffer) { return buffer.first == thread; });
+                if (it == buffers.end())
+                {
+                    buffers.emplace_back(thread, std::make_unique<trace_buffer>());
+                    it = buffers.end() - 1;
+                    it->second->thread_id = int(buffers.size());
+                }
+                cached = { id, it->second.get() };
+                return *cached.second;
+            }
+
+            void record(trace_kind kind, const void* subject, char phase)
+            {
+                const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+                local().push({ subject, timestamp, kind, phase });
+            }
+
+            static void escape(std::string& out, std::string_view text)
+            {
+                for (const char c: text)
+                {
+                    if (c == '"' || c == '\\') { out += '\\'; out += c; }
+                    else if ((unsigned char)c < 0x20) { out += fmt::format("\\u{:04x}", (int)c); }
+                    else { out += c; }
+                }
+            }
+
+            void write(const std::filesystem::path& filepath)
+            {
+                std::lock_guard lock(mutex);
+                std::string json = "{\"traceEvents\":[\n";
+                bool first = true;
+                for (const auto& [thread, buffer]: buffers)
+                {
+                    const std::size_t head = buffer->head.load(std::memory_order_acquire);
+                    const std::size_t tail = head > trace_buffer::capacity ? head - trace_buffer::capacity : 0;
+                    for (std::size_t i = tail; i < head; i++)
+                    {
+                        const auto& event = buffer->events[i % trace_buffer::capacity];
+                        json += first ? "" : ",\n";
+                        first = false;
+                        json += "{\"name\":\"";
+                        if (event.kind == trace_kind::fixture)
+                        {
+                            const auto& f = *static_cast<const fixture*>(event.subject);
+                            escape(json, fmt::format("{}.{}", f.group(), f.name()));
+                        }
+                        else
+                        {
+                            escape(json, static_cast<const char*>(event.subject));
+                        }
+                        json += fmt::format("\",\"cat\":\"{}\",\"ph\":\"{}\",\"ts\":{:.3f},\"pid\":1,\"tid\":{}}}"
+                            , event.kind == trace_kind::fixture ? "fixture" : "section"
+                            , event.phase
+                            , event.timestamp / 1000.0
+                            , buffer->thread_id);
+                    }
+                }
+                json += "\n]}\n";
+                std::ofstream(filepath, std::ios::binary) << json;
+
+                // Runs of a session are sequential, nobody is recording at this point
+                for (const auto& [thread, buffer]: buffers)
+                    buffer->head.store(0, std::memory_order_relaxed);
+            }
+        };
+    }
+
+    // ---------------------------------------- JOURNAL
+
+    namespace
+    {
+        // Records are appended as text lines into a shared file mapping: the kernel
+        // keeps the written pages even when the process dies in the middle of a
+        // fixture, the zeroed tail of the file marks where the records stop
+        struct journal_writer
+        {
+            static constexpr std::size_t initial_capacity = 1 << 20;
+
+            bool enabled = false;
+            // Held in memory for another journal to take, see replay_worker
+            bool buffered = false;
+            std::string buffer = {};
+            int fd = -1;
+            char* data = nullptr;
+            std::size_t capacity = 0;
+            std::size_t length = 0;
+
+            bool map(std::size_t size)
+            {
+#ifdef UTEST_POSIX
+                if (data)
+                    munmap(data, capacity);
+                data = nullptr;
+                if (ftruncate(fd, off_t(size)) != 0)
+                    return false;
+                void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (mapping == MAP_FAILED)
+                    return false;
+                data = static_cast<char*>(mapping);
+                capacity = size;
+                return true;
+#else
+                (void)size;
+                return false;
+#endif
+            }
+
+            bool open(const std::filesystem::path& path, bool append)
+            {
+#ifdef UTEST_POSIX
+                fd = ::open(path.c_str(), O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+                length = 0;
+                const off_t size = fd >= 0 ? lseek(fd, 0, SEEK_END) : 0;
+                enabled = fd >= 0 && map(std::max(initial_capacity, std::size_t(size) + 1));
+                if (enabled && append)
+                {
+                    // Continue after the last complete record, dropping one cut short
+                    const char* end = static_cast<const char*>(std::memchr(data, '\0', capacity));
+                    const std::string_view content(data, end ? end - data : capacity);
+                    const std::size_t last = content.rfind('\n');
+                    length = last == std::string_view::npos ? 0 : last + 1;
+                    std::memset(data + length, 0, capacity - length);
+                }
+#else
+                (void)path;
+                (void)append;
+#endif
+                return enabled;
+            }
+
+            void append(std::string_view record)
+            {
+                if (buffered)
+                {
+                    buffer += record;
+                    return;
+                }
+                if (length + record.size() >= capacity && !map(std::max(capacity * 2, length + record.size() + 1)))
+                {
+                    enabled = false;
+                    return;
+                }
+                std::memcpy(data + length, record.data(), record.size());
+                length += record.size();
+            }
+
+            void close()
+            {
+#ifdef UTEST_POSIX
+                if (data)
+                    munmap(data, capacity);
+                if (fd >= 0)
+                {
+                    if (ftruncate(fd, off_t(length)) != 0) {}
+                    ::close(fd);
+                }
+#endif
+                data = nullptr;
+                fd = -1;
+                enabled = false;
+            }
+
+            static std::string field(std::string_view text)
+            {
+                std::string result(text);
+                std::replace_if(result.begin(), result.end(), [](char c) { return c == '\t' || c == '\n'; }, ' ');
+                return result;
+            }
+
+            void started(const fixture& f) { append(fmt::format("start\t{}.{}\n", f.group(), f.name())); }
+            void failed(const fixture& f, const char* location, const std::string& expression) { append(fmt::format("fail\t{}.{}\t{}\t{}\n", f.group(), f.name(), field(location), field(expression))); }
+            void finished(const fixture& f)
+            {
+                append(fmt::format("finish\t{}.{}\t{}\t{}\t{}\n", f.group(), f.name(), f.cases, f.errors
+                    , std::chrono::duration_cast<std::chrono::microseconds>(f.duration).count()));
+            }
+            void ended(int numtests, int numerrors) { append(fmt::format("end\t{}\t{}\n", numtests, numerrors)); }
+        };
+    }
+
+    std::vector<journal_entry> journal::read(const std::filesystem::path& path)
+    {
+        std::vector<journal_entry> entries;
+        std::unordered_map<std::string, std::size_t> indices;
+        std::ifstream file(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        content.resize(std::min(content.size(), content.find('\0')));
+
+        std::size_t position = 0;
+        while (true)
+        {
+            // A record without its line feed was cut short by a crash
+            const std::size_t end = content.find('\n', position);
+            if (end == std::string::npos)
+                break;
+
+            std::vector<std::string_view> fields;
+            std::string_view line(content.data() + position, end - position);
+            position = end + 1;
+            for (std::size_t tab; (tab = line.find('\t')) != std::string_view::npos; line.remove_prefix(tab + 1))
+                fields.push_back(line.substr(0, tab));
+            fields.push_back(line);
+            if (fields.size() < 2)
+                continue;
+
+            const std::string fixture(fields[1]);
+            if (fields[0] == "start")
+            {
+                indices[fixture] = entries.size();
+                entries.push_back({ fixture });
+                continue;
+            }
+
+            auto it = indices.find(fixture);
+            if (it == indices.end())
+                continue;
+            auto& entry = entries[it->second];
+            if (fields[0] == "fail" && fields.size() >= 4)
+            {
+                entry.failures.push_back(fmt::format("{}: {}", fields[2], fields[3]));
+            }
+            else if (fields[0] == "finish" && fields.size() >= 5)
+            {
+                entry.finished = true;
+                entry.cases = std::atoi(std::string(fields[2]).c_str());
+                entry.errors = std::atoi(std::string(fields[3]).c_str());
+                entry.duration = std::chrono::microseconds(std::atoll(std::string(fields[4]).c_str()));
+            }
+        }
+        return entries;
+    }
+
+    // ---------------------------------------- SESSION STATE
+
+    struct hotspot
+    {
+        const char* file;
+        int line;
+        std::uint64_t count = 0;
+        std::uint64_t failures = 0;
+        std::chrono::steady_clock::duration time = {};
+    };
+
+    struct session_state
+    {
+        tracer trace;
+        journal_writer journal;
+
+        // Threads a fixture starts may assert along with it: reports and
+        // section changes of the session's fixtures take turns
+        std::mutex report_mutex;
+
+        // By (file, line), threads a fixture starts may assert as well
+        std::mutex hotspots_mutex;
+        std::map<std::pair<std::uintptr_t, int>, hotspot> hotspots;
+
+        // Tags by bit position, selecting by tags is a few mask operations per fixture
+        std::unordered_map<std::string, std::size_t> tag_ids;
+        std::vector<std::uint64_t> required_tags;
+        std::vector<std::uint64_t> forbidden_tags;
+    };
+
+    namespace
+    {
+        std::size_t intern_tag(session_state& state, std::string_view tag)
+        {
+            return state.tag_ids.try_emplace(std::string(tag), state.tag_ids.size()).first->second;
+        }
+
+        void set_bit(std::vector<std::uint64_t>& bits, std::size_t index)
+        {
+            if (bits.size() <= index / 64)
+                bits.resize(index / 64 + 1);
+            bits[index / 64] |= std::uint64_t(1) << (index % 64);
+        }
+
+        const std::vector<std::uint64_t>& tag_bits(session_state& state, const fixture& fixture)
+        {
+            if (!fixture.tags_interned)
+            {
+                for (const auto tag: split_list(fixture.attributes().tags))
+                    set_bit(fixture.tag_bits, intern_tag(state, tag));
+                fixture.tags_interned = true;
+            }
+            return fixture.tag_bits;
+        }
+
+        // Sessions running fixtures, threads without a fixture report to the
+        // latest fixture of the running session only when there is only one
+        struct running_sessions
+        {
+            static inline std::mutex mutex;
+            static inline std::vector<session*> sessions = {};
+            static inline std::atomic<session*> sole = nullptr;
+
+            static void update() { sole = sessions.size() == 1 ? sessions.front() : nullptr; }
+        };
+
+        struct running_scope
+        {
+            session& owner;
+
+            explicit running_scope(session& owner)
+                : owner(owner)
+            {
+                std::lock_guard lock(running_sessions::mutex);
+                running_sessions::sessions.push_back(&owner);
+                running_sessions::update();
+            }
+
+            running_scope(const running_scope&) = delete;
+            running_scope& operator=(const running_scope&) = delete;
+
+            ~running_scope()
+            {
+                std::lock_guard lock(running_sessions::mutex);
+                auto& sessions = running_sessions::sessions;
+                sessions.erase(std::find(sessions.begin(), sessions.end(), &owner));
+                running_sessions::update();
+            }
+        };
+    }
+
+    // ---------------------------------------- MODULES
+
+    namespace
+    {
+        // Static initialization of a module runs on the thread opening it
+        thread_local session* loading_session = nullptr;
+    }
+
+    bool session::load(const std::filesystem::path& module)
+    {
+#ifdef UTEST_POSIX
+        // Static fixtures are only constructed once, a module can't be shared
+        if (void* handle = dlopen(module.c_str(), RTLD_NOW | RTLD_NOLOAD))
+        {
+            dlclose(handle);
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- {} is already loaded", module.string()));
+            return false;
+        }
+
+        // Fixtures of the module join this session while it is opened
+        loading_session = this;
+        void* handle = dlopen(module.c_str(), RTLD_NOW | RTLD_LOCAL);
+        loading_session = nullptr;
+        if (!handle)
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- could not load {}: {}", module.string(), dlerror()));
+            return false;
+        }
+        modules.emplace_back(module, handle);
+        return true;
+#else
+        fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- loading modules is not supported on this platform ({})", module.string()));
+        return false;
+#endif
+    }
+
+    bool session::unload(const std::filesystem::path& module)
+    {
+#ifdef UTEST_POSIX
+        auto it = std::find_if(modules.begin(), modules.end(), [&](const auto& loaded) { return loaded.first == module; });
+        if (it == modules.end())
+            return false;
+
+        dlclose(it->second);
+
+        // Unique symbols (GCC without -fno-gnu-unique) keep a module resident
+        if (void* handle = dlopen(module.c_str(), RTLD_NOW | RTLD_NOLOAD))
+        {
+            dlclose(handle);
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- {} could not be unloaded, its fixtures stay registered", module.string()));
+        }
+        modules.erase(it);
+        return true;
+#else
+        (void)module;
+        return false;
+#endif
+    }
+
     // ---------------------------------------- FIXTURE
 
     fixture::fixture()
+        : fixture(loading_session ? *loading_session : suite::default_session()) {}
+
+    fixture::fixture(session& owner)
+        : owner(&owner)
+    {
+        owner.fixtures.push_back(this);
+    }
+
+    fixture::~fixture()
+    {
+        if (!temp_path.empty())
+            remove_temp_dir();
+
+        // Fixtures usually go in the reverse order they came
+        auto it = std::find(owner->fixtures.rbegin(), owner->fixtures.rend(), this);
+        if (it != owner->fixtures.rend())
+            owner->fixtures.erase(std::next(it).base());
+
+        if (suite::current == this)
+            suite::current = nullptr;
+        fixture* self = this;
+        owner->latest.compare_exchange_strong(self, nullptr);
+    }
+
+    void fixture::reset()
     {
-        suite::fixtures.push_back(this);
+        sections = {};
+        sections.node = &sections.nodes.front();
+        from_threads = {};
+        section_changed = true;
+        printed_something = false;
+        cases = 0;
+        caseindex = 0;
+        errors = 0;
+        duration = {};
+        first_failure.clear();
+        failure_sites.clear();
+        failure_site_index.clear();
+        remove_temp_dir();
     }
 
     void fixture::setup()
     {
-        fmt::print("{}"
+        if (owner->config.verbosity == verbosity::silent)
+            return;
+
+        fmt::print(owner->config.output, "{}"
             , fmt::format(
                   fmt::fg(fmt::terminal_color::bright_blue)
                 , "-- {}.{}"
@@ -23,19 +602,142 @@ namespace utest
     }
     void fixture::teardown()
     {
-        if (!printed_something)
+        if (owner->config.verbosity >= verbosity::everything && sections.nodes.size() > 1)
+            print_section_summary();
+        if (owner->config.verbosity > verbosity::quiet)
+            print_repeated_failures();
+
+        if (!printed_something && owner->config.verbosity > verbosity::silent)
         {
             auto style = fmt::fg(errors == 0 ? fmt::terminal_color::green : fmt::terminal_color::bright_red);
-            fmt::println(" -> {} {}"
+            fmt::println(owner->config.output, " -> {} {}"
                 , fmt::format(style, "{}", errors == 0 ? "passed" : "failed")
                 , fmt::format("[{}/{}]", (cases - errors), cases)
             );
         }
+
+        if (errors > 0 && owner->config.keep_temp && !temp_path.empty())
+        {
+            if (owner->config.verbosity > verbosity::silent)
+                fmt::println(owner->config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "\tkept {}", temp_path.string()));
+            temp_path.clear();
+        }
+        remove_temp_dir();
+    }
+
+    void fixture::push_section(const char* name)
+    {
+        const std::lock_guard lock(owner->state->report_mutex);
+        auto& parent = *sections.node;
+        auto it = parent.children.find(name);
+        if (it == parent.children.end())
+        {
+            const int id = int(sections.nodes.size());
+            auto& node = sections.nodes.emplace_back(section_node { name, sections.current });
+            node.path = sections.current == 0 ? node.name : parent.path + " > " + node.name;
+            it = parent.children.emplace(node.name, id).first;
+        }
+
+        sections.stack.emplace_back(sections.current, std::chrono::steady_clock::now());
+        sections.current = it->second;
+        sections.node = &sections.nodes[sections.current];
+        section_changed = true;
+        if (auto& trace = owner->state->trace; trace.enabled)
+            trace.record(trace_kind::section, sections.node->name.c_str(), 'B');
+    }
+
+    void fixture::pop_section()
+    {
+        const std::lock_guard lock(owner->state->report_mutex);
+        if (sections.stack.empty())
+            return;
+
+        auto& node = *sections.node;
+        if (auto& trace = owner->state->trace; trace.enabled)
+            trace.record(trace_kind::section, node.name.c_str(), 'E');
+
+        const auto [parent, entered] = sections.stack.back();
+        sections.stack.pop_back();
+        node.time += std::chrono::steady_clock::now() - entered;
+        sections.current = parent;
+        sections.node = &sections.nodes[sections.current];
+        section_changed = true;
+    }
+
+    void fixture::add_case()
+    {
+        if (on_own_thread())
+        {
+            cases++;
+            return;
+        }
+        const std::lock_guard lock(owner->state->report_mutex);
+        from_threads.cases++;
+    }
+
+    void fixture::add_passed_from_thread()
+    {
+        const std::lock_guard lock(owner->state->report_mutex);
+        from_threads.cases++;
+        count_result(true);
+    }
+
+    void fixture::count_result(bool success)
+    {
+        if (on_own_thread())
+        {
+            errors += !success;
+            (success ? sections.node->passed : sections.node->failed)++;
+            caseindex++;
+            return;
+        }
+
+        // Sections only change under the report lock, current is the one to count in
+        from_threads.errors += !success;
+        from_threads.sections.resize(sections.nodes.size());
+        auto& section = from_threads.sections[sections.current];
+        (success ? section.first : section.second)++;
+        from_threads.caseindex++;
+    }
+
+    int fixture::failures() const
+    {
+        if (on_own_thread())
+            return errors;
+        const std::lock_guard lock(owner->state->report_mutex);
+        return from_threads.errors;
+    }
+
+    void fixture::join_thread_counts()
+    {
+        const std::lock_guard lock(owner->state->report_mutex);
+        cases += from_threads.cases;
+        caseindex += from_threads.caseindex;
+        errors += from_threads.errors;
+        for (std::size_t id = 0; id < from_threads.sections.size(); id++)
+        {
+            sections.nodes[id].passed += from_threads.sections[id].first;
+            sections.nodes[id].failed += from_threads.sections[id].second;
+        }
+        from_threads = {};
     }
 
-    void fixture::push_section(const char* name) { section_changed = true; sections.current++; sections.names[sections.current] = name; }
-    void fixture::pop_section() { section_changed = true; sections.current--; }
-    void fixture::add_case() { cases++; }
+    bool fixture::count_repeated_failure(const char* file, int line)
+    {
+        const int limit = owner->config.max_failures;
+        if (limit <= 0)
+            return false;
+
+        const std::lock_guard lock(owner->state->report_mutex);
+        const auto [it, inserted] = failure_site_index.try_emplace({ reinterpret_cast<std::uintptr_t>(file), line }, failure_sites.size());
+        if (inserted)
+            failure_sites.push_back({ file, line });
+        if (++failure_sites[it->second].count <= limit)
+            return false;
+
+        count_result(false);
+        return true;
+    }
 
     void fixture::print_section() const
     {
@@ -43,26 +745,76 @@ namespace utest
             return;
 
         section_changed = false;
-        const auto name_range = make_range(sections.names.begin() + 1, sections.names.begin() + sections.current + 1);
-        if (name_range.begin() == name_range.end())
+        if (sections.current == 0)
             return;
 
-        const auto sectionString = join(name_range, " > ");
-        fmt::println("{}"
+        fmt::println(owner->config.output, "{}"
             , fmt::format(
                   fmt::fg(fmt::terminal_color::bright_blue)
                 , "-- {}.{} > {}"
                 , group(), name()
-                , sectionString.c_str()
+                , sections.node->path
             ));
     }
 
+    void fixture::print_section_summary() const
+    {
+        // Nodes only count their own cases, a section includes those of its
+        // children as its time does; children always come after their parent
+        std::vector<std::pair<int, int>> totals(sections.nodes.size());
+        for (std::size_t id = sections.nodes.size(); id-- > 1;)
+        {
+            const auto& node = sections.nodes[id];
+            totals[id].first += node.passed;
+            totals[id].second += node.failed;
+            totals[node.parent].first += totals[id].first;
+            totals[node.parent].second += totals[id].second;
+        }
+
+        for (std::size_t id = 1; id < sections.nodes.size(); id++)
+        {
+            const auto& node = sections.nodes[id];
+            const auto [passed, failed] = totals[id];
+            auto style = fmt::fg(failed == 0 ? fmt::terminal_color::green : fmt::terminal_color::bright_red);
+            fmt::println(owner->config.output, "\t{} -> {} {}"
+                , node.path
+                , fmt::format(style, "[{}/{}]", passed, passed + failed)
+                , fmt::format(fmt::fg(fmt::terminal_color::bright_black), "{:.3f}ms", std::chrono::duration<double, std::milli>(node.time).count())
+            );
+        }
+    }
+
+    void fixture::record_hotspot(const char* file, int line, bool failed, std::chrono::steady_clock::duration time)
+    {
+        auto& state = *owner->state;
+        std::lock_guard lock(state.hotspots_mutex);
+        auto& hotspot = state.hotspots.try_emplace({ reinterpret_cast<std::uintptr_t>(file), line }, utest::hotspot { file, line }).first->second;
+        hotspot.count++;
+        hotspot.failures += failed;
+        hotspot.time += time;
+    }
+
+    void fixture::print_repeated_failures() const
+    {
+        const int limit = owner->config.max_failures;
+        for (const auto& site: failure_sites)
+        {
+            if (limit <= 0 || site.count <= limit)
+                continue;
+
+            if (!printed_something)
+                fmt::println(owner->config.output, "");
+            fmt::println(owner->config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red)
+                , "\t... and {} more at {}:{}", group_thousands(site.count - limit), owner->ez_file(site.file), site.line));
+        }
+    }
+
     void fixture::print_case_header(bool success, const char* location) const
     {
         auto success_style = fmt::fg(success ? fmt::terminal_color::green : fmt::terminal_color::bright_red);
         auto location_style = fmt::fg(fmt::terminal_color::bright_black);
-        fmt::println("{} {} -> {}"
-            , fmt::format("[{}]", caseindex)
+        fmt::println(owner->config.output, "{} {} -> {}"
+            , fmt::format("[{}]", on_own_thread() ? caseindex : from_threads.caseindex)
             , fmt::format(location_style, "{}", location)
             , fmt::format(success_style, "{}", success ? "success" : "failure")
         );
@@ -70,128 +822,2429 @@ namespace utest
 
     void fixture::print_case_expression(const char* op, const char* left, const char* right)
     {
-        fmt::println("\t\twhile evaluating:\n\t\t\t\"{}\"\n\t\t\t\t{}\n\t\t\t\"{}\"\n", left, op, right);
+        // test_check only knows the whole expression
+        if (!right)
+            fmt::println(owner->config.output, "\t\twhile evaluating:\n\t\t\t\"{}\"\n", left);
+        else
+            fmt::println(owner->config.output, "\t\twhile evaluating:\n\t\t\t\"{}\"\n\t\t\t\t{}\n\t\t\t\"{}\"\n", left, op, right);
+    }
+
+    void fixture::print_case_evaluation(const char* left, const char* right, bool truncate)
+    {
+        // When a diff follows, huge values are cut down to their beginning
+        static constexpr std::size_t max_length = 256;
+        const auto shorten = [truncate](std::string_view value)
+        {
+            if (!truncate || value.size() <= max_length)
+                return std::string(value);
+            return fmt::format("{}... ({} more characters)", value.substr(0, max_length), value.size() - max_length);
+        };
+
+        if (!right)
+            fmt::println(owner->config.output, "\t\tvalue: {}", shorten(left));
+        else
+            fmt::println(owner->config.output, "\t\tleft: {}\n\t\tright: {}"
+                , shorten(left)
+                , shorten(right));
+    }
+
+    void fixture::print_case_details(const char* details)
+    {
+        fmt::println(owner->config.output, "{}", details);
     }
 
-    void fixture::print_case_evaluation(const char* left, const char* right)
+    void fixture::print_captured(std::string_view captured)
     {
-        fmt::println("\t\tleft: {}\n\t\tright: {}"
-            , left
-            , right);
+        // The end of the output is usually what explains the failure
+        static constexpr std::size_t max_length = 1 << 16;
+        if (captured.size() > max_length)
+        {
+            const std::size_t cut = captured.find('\n', captured.size() - max_length);
+            const std::size_t skipped = cut == std::string_view::npos ? captured.size() - max_length : cut + 1;
+            fmt::println(owner->config.output, "\t\tcaptured output ({} bytes before):", skipped);
+            captured.remove_prefix(skipped);
+        }
+        else
+        {
+            fmt::println(owner->config.output, "\t\tcaptured output:");
+        }
+
+        while (!captured.empty())
+        {
+            const std::size_t end = std::min(captured.find('\n'), captured.size());
+            fmt::println(owner->config.output, "\t\t\t| {}", captured.substr(0, end));
+            captured.remove_prefix(std::min(end + 1, captured.size()));
+        }
     }
 
     void fixture::add_result(bool success
         , const char* location
         , const char* op
         , const char* left_expression, const char* right_expression
-        , const char* left_evaluated, const char* right_evaluated)
+        , const char* left_evaluated, const char* right_evaluated
+        , const char* details)
     {
+        const std::lock_guard lock(owner->state->report_mutex);
         if (!success)
-            errors++;
+        {
+            auto& journal = owner->state->journal;
+            if (journal.enabled || first_failure.empty())
+            {
+                const auto expression = right_expression ? fmt::format("{} {} {}", left_expression, op, right_expression) : std::string(left_expression);
+                if (journal.enabled)
+                    journal.failed(*this, location, expression);
+                if (first_failure.empty())
+                    first_failure = fmt::format("{}: {}", location, expression);
+            }
+        }
 
-        if (suite::config::verbosity > verbosity::quiet)
+        if (owner->config.verbosity > verbosity::quiet)
         {
-            if (!success || (suite::config::verbosity >= verbosity::passed))
+            if (!success || (owner->config.verbosity >= verbosity::passed))
             {
                 if (!printed_something)
                 {
-                    fmt::println("");
+                    fmt::println(owner->config.output, "");
                     printed_something = true;
                 }
                 print_section();
                 print_case_header(success, location);
-                if (!success || (suite::config::verbosity >= verbosity::everything))
+                if (!success || (owner->config.verbosity >= verbosity::everything))
                 {
                     print_case_expression(op, left_expression, right_expression);
-                    print_case_evaluation(left_evaluated, right_evaluated);
+                    print_case_evaluation(left_evaluated, right_evaluated, details[0] != '\0');
+                    if (details[0] != '\0')
+                        print_case_details(details);
                 }
             }
         }
-        caseindex++;
+        count_result(success);
     }
 
-    // ---------------------------------------- SECTION
+    // ---------------------------------------- TEMPORARY DIRECTORIES
 
-    section::section(const char* name) { suite::current->push_section(name); }
-    section::~section() { suite::current->pop_section(); }
-    section::operator bool() const { return true; }
+    namespace
+    {
+        // Fixtures may ask from the threads they start
+        std::mutex temp_mutex;
 
-    // ---------------------------------------- SUITE
+        bool is_tmpfs(const std::filesystem::path& path)
+        {
+#ifdef __linux__
+            struct statfs info;
+            return statfs(path.c_str(), &info) == 0 && info.f_type == TMPFS_MAGIC && access(path.c_str(), W_OK | X_OK) == 0;
+#else
+            (void)path;
+            return false;
+#endif
+        }
+
+        // The first tmpfs among the usual places, the system temporary directory otherwise
+        const std::filesystem::path& default_temp_root()
+        {
+            static const std::filesystem::path root = []()
+            {
+                std::error_code error;
+                std::vector<std::filesystem::path> candidates;
+                if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"))
+                    candidates.emplace_back(runtime);
+                candidates.emplace_back("/dev/shm");
+                candidates.push_back(std::filesystem::temp_directory_path(error));
+                for (const auto& candidate: candidates)
+                {
+                    if (!candidate.empty() && is_tmpfs(candidate))
+                        return candidate;
+                }
+                return candidates.back();
+            }();
+            return root;
+        }
 
-    verbosity suite::config::verbosity = verbosity::failures;
-    std::filesystem::path suite::config::source_root = {};
-    std::vector<fixture*> suite::fixtures = {};
-    fixture* suite::current = nullptr;
+        std::filesystem::path make_temp_dir(const std::filesystem::path& root, std::string_view name)
+        {
+            const auto& parent = root.empty() ? default_temp_root() : root;
+            const auto base = parent / fmt::format("utest-{}-", name);
+            std::error_code error;
+            std::filesystem::create_directories(parent, error);
+#ifdef UTEST_POSIX
+            std::string path = base.string() + "XXXXXX";
+            if (mkdtemp(path.data()))
+                return path;
+#endif
+            // Unique enough without mkdtemp, create_directory fails if it exists
+            static std::atomic<unsigned> counter = 0;
+            for (int attempt = 0; attempt < 100; attempt++)
+            {
+                auto path = base;
+                path += fmt::format("{:x}-{}", std::random_device{}(), counter++);
+                if (std::filesystem::create_directories(path, error))
+                    return path;
+            }
+            return {};
+        }
+    }
 
-    std::string suite::ez_file(const char* filepath)
+    std::filesystem::path fixture::temp_dir()
     {
-        std::filesystem::path fp(filepath);
-        return std::filesystem::relative(fp, config::source_root).string();
+        std::lock_guard lock(temp_mutex);
+        if (temp_path.empty())
+            temp_path = make_temp_dir(owner->config.temp_root, fmt::format("{}.{}", group(), name()));
+        return temp_path;
     }
 
-    int suite::runall()
+    void fixture::remove_temp_dir()
     {
-        int numpassed = 0;
-        int numtests = 0;
-        int numcases = 0;
-        int numerrors = 0;
+        std::lock_guard lock(temp_mutex);
+        if (temp_path.empty())
+            return;
 
-        for (auto fixture: fixtures)
+        std::error_code error;
+        std::filesystem::remove_all(temp_path, error);
+        temp_path.clear();
+    }
+
+    std::filesystem::path temp_dir()
+    {
+        fixture* fixture = suite::current_fixture();
+        return fixture ? fixture->temp_dir() : make_temp_dir(suite::config::temp_root, "detached");
+    }
+
+    // ---------------------------------------- DIFF
+
+    namespace
+    {
+        enum class edit_kind
         {
-            current = fixture;
-            fixture->setup();
-            fixture->run();
-            fixture->teardown();
-            numtests++;
-            numcases += fixture->cases;
-            numerrors += fixture->errors;
-            if (fixture->errors == 0)
-                numpassed++;
+            keep,
+            remove,
+            insert
+        };
+
+        struct edit
+        {
+            edit_kind kind;
+            std::size_t left;
+            std::size_t right;
+            std::size_t count;
+        };
+
+        // Myers' O(ND) difference algorithm, linear space variant: the middle snake
+        // is searched from both ends at once and the problem is split around it.
+        // Past the time cap, remaining sub-problems are reported as a plain
+        // remove + insert which is still a valid (if not minimal) edit script
+        template <typename Equal>
+        struct myers
+        {
+            static constexpr auto time_cap = std::chrono::milliseconds(100);
+
+            const Equal& equal;
+            const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + time_cap;
+            std::vector<edit> script = {};
+
+            void emit(edit_kind kind, std::size_t left, std::size_t right, std::size_t count)
+            {
+                if (count == 0)
+                    return;
+                if (!script.empty() && script.back().kind == kind)
+                    script.back().count += count;
+                else
+                    script.push_back({ kind, left, right, count });
+            }
+
+            void compare(std::size_t l0, std::size_t l1, std::size_t r0, std::size_t r1)
+            {
+                std::size_t prefix = 0;
+                while (l0 + prefix < l1 && r0 + prefix < r1 && equal(l0 + prefix, r0 + prefix))
+                    prefix++;
+                emit(edit_kind::keep, l0, r0, prefix);
+                l0 += prefix;
+                r0 += prefix;
+
+                std::size_t suffix = 0;
+                while (l0 < l1 - suffix && r0 < r1 - suffix && equal(l1 - suffix - 1, r1 - suffix - 1))
+                    suffix++;
+                l1 -= suffix;
+                r1 -= suffix;
+
+                if (l0 == l1)
+                    emit(edit_kind::insert, l0, r0, r1 - r0);
+                else if (r0 == r1)
+                    emit(edit_kind::remove, l0, r0, l1 - l0);
+                else
+                    bisect(l0, l1, r0, r1);
+
+                emit(edit_kind::keep, l1, r1, suffix);
+            }
+
+            void bisect(std::size_t l0, std::size_t l1, std::size_t r0, std::size_t r1)
+            {
+                // The search's vectors are gone before recursing, so that only
+                // one pair is ever alive and the space stays linear
+                if (const auto snake = middle_snake(l0, l1, r0, r1))
+                {
+                    compare(l0, l0 + snake->first, r0, r0 + snake->second);
+                    compare(l0 + snake->first, l1, r0 + snake->second, r1);
+                }
+                else
+                {
+                    emit(edit_kind::remove, l0, r0, l1 - l0);
+                    emit(edit_kind::insert, l1, r0, r1 - r0);
+                }
+            }
+
+            // Where the forward and backward paths overlap, none past the time cap
+            std::optional<std::pair<std::size_t, std::size_t>> middle_snake(std::size_t l0, std::size_t l1, std::size_t r0, std::size_t r1)
+            {
+                using index = std::ptrdiff_t;
+                const index n = index(l1 - l0);
+                const index m = index(r1 - r0);
+                const index max_d = (n + m + 1) / 2;
+                const index delta = n - m;
+                const bool front = (delta % 2) != 0;
+
+                // Diagonals are only reached one step at a time: sized for the
+                // first few and doubled as d grows, a few edits in megabytes of
+                // text don't pay for n + m of them up front
+                index offset = std::min<index>(max_d, 64);
+                index length = 2 * offset;
+                std::vector<index> forward(length + 2, -1);
+                std::vector<index> backward(length + 2, -1);
+                forward[offset + 1] = 0;
+                backward[offset + 1] = 0;
+
+                const auto grow = [&](std::vector<index>& diagonals, index from)
+                {
+                    std::vector<index> grown(length + 2, -1);
+                    std::copy(diagonals.begin(), diagonals.end(), grown.begin() + (offset - from));
+                    diagonals = std::move(grown);
+                };
+
+                index k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+                for (index d = 0; d < max_d; d++)
+                {
+                    if (std::chrono::steady_clock::now() > deadline)
+                        break;
+
+                    if (d + 1 > offset)
+                    {
+                        const index from = offset;
+                        offset = std::min(max_d, 2 * offset);
+                        length = 2 * offset;
+                        grow(forward, from);
+                        grow(backward, from);
+                    }
+
+                    for (index k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+                    {
+                        const index k1offset = offset + k1;
+                        index x1 = (k1 == -d || (k1 != d && forward[k1offset - 1] < forward[k1offset + 1]))
+                            ? forward[k1offset + 1]
+                            : forward[k1offset - 1] + 1;
+                        index y1 = x1 - k1;
+                        while (x1 < n && y1 < m && equal(l0 + x1, r0 + y1))
+                        {
+                            x1++;
+                            y1++;
+                        }
+                        forward[k1offset] = x1;
+
+                        if (x1 > n)
+                        {
+                            k1end += 2;
+                        }
+                        else if (y1 > m)
+                        {
+                            k1start += 2;
+                        }
+                        else if (front)
+                        {
+                            const index k2offset = offset + delta - k1;
+                            if (k2offset >= 0 && k2offset < length && backward[k2offset] != -1 && x1 >= n - backward[k2offset])
+                                return std::pair(std::size_t(x1), std::size_t(y1));
+                        }
+                    }
+
+                    for (index k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+                    {
+                        const index k2offset = offset + k2;
+                        index x2 = (k2 == -d || (k2 != d && backward[k2offset - 1] < backward[k2offset + 1]))
+                            ? backward[k2offset + 1]
+                            : backward[k2offset - 1] + 1;
+                        index y2 = x2 - k2;
+                        while (x2 < n && y2 < m && equal(l0 + n - x2 - 1, r0 + m - y2 - 1))
+                        {
+                            x2++;
+                            y2++;
+                        }
+                        backward[k2offset] = x2;
+
+                        if (x2 > n)
+                        {
+                            k2end += 2;
+                        }
+                        else if (y2 > m)
+                        {
+                            k2start += 2;
+                        }
+                        else if (!front)
+                        {
+                            const index k1offset = offset + delta - k2;
+                            if (k1offset >= 0 && k1offset < length && forward[k1offset] != -1)
+                            {
+                                const index x1 = forward[k1offset];
+                                const index y1 = offset + x1 - k1offset;
+                                if (x1 >= n - x2)
+                                    return std::pair(std::size_t(x1), std::size_t(y1));
+                            }
+                        }
+                    }
+                }
+
+                return std::nullopt;
+            }
+        };
+
+        template <typename Equal>
+        std::vector<edit> edit_script(std::size_t left_size, std::size_t right_size, const Equal& equal)
+        {
+            myers<Equal> algorithm { equal };
+            algorithm.compare(0, left_size, 0, right_size);
+            return std::move(algorithm.script);
         }
 
-        if (numpassed != numtests)
+        // Renders changes as "[-removed-]{+inserted+}" with a bit of surrounding
+        // context, changes separated by less than twice the context share a hunk
+        template <typename Token>
+        std::string render_edit_script(const std::vector<edit>& script, const Token& token, std::string_view separator)
         {
-            auto style = fmt::fg(fmt::terminal_color::bright_red);
-            fmt::println(     "--------------------------");
-            fmt::print(style, "-> some tests have failed: ");
-            int pindex = 0;
-            for (const auto& fixture: fixtures)
+            static constexpr std::size_t context = 16;
+            static constexpr std::size_t max_tokens = 80;
+            static constexpr int max_hunks = 16;
+
+            const auto append = [&](std::string& out, bool left, std::size_t first, std::size_t count)
             {
-                if (fixture->errors == 0)
+                const std::size_t shown = std::min(count, max_tokens);
+                for (std::size_t i = 0; i < shown; i++)
+                {
+                    if (i > 0)
+                        out += separator;
+                    token(out, left, first + i);
+                }
+                if (shown < count)
+                    out += fmt::format("{}... ({} more)", separator, count - shown);
+            };
+
+            std::string result = "\t\tdiff:";
+            int hunks = 0;
+            std::size_t i = 0;
+            while (i < script.size())
+            {
+                if (script[i].kind == edit_kind::keep)
+                {
+                    i++;
                     continue;
+                }
 
-                fmt::print("{}.{} ({})", fixture->group(), fixture->name(), fixture->errors);
-                if ((numtests - numpassed) > (pindex + 2))
-                    fmt::print(", ");
-                else if ((numtests - numpassed) > (pindex + 1))
-                    fmt::print(" & ");
+                if (hunks == max_hunks)
+                {
+                    int remaining = 0;
+                    for (; i < script.size(); i++)
+                        if (script[i].kind != edit_kind::keep && (i == 0 || script[i - 1].kind == edit_kind::keep))
+                            remaining++;
+                    result += fmt::format("\n\t\t\t... and {} more changes", remaining);
+                    break;
+                }
 
-                pindex++;
+                std::size_t j = i;
+                while (j < script.size() && (script[j].kind != edit_kind::keep || (j + 1 < script.size() && script[j].count <= 2 * context)))
+                    j++;
+
+                std::string line = fmt::format("\n\t\t\t@ {},{}: ", script[i].left, script[i].right);
+                if (i > 0)
+                {
+                    const auto& keep = script[i - 1];
+                    const std::size_t count = std::min(keep.count, context);
+                    if (count < keep.count)
+                        line += fmt::format("...{}", separator);
+                    append(line, true, keep.left + keep.count - count, count);
+                    line += separator;
+                }
+                for (std::size_t e = i; e < j; e++)
+                {
+                    const auto& change = script[e];
+                    if (e > i)
+                        line += separator;
+                    if (change.kind == edit_kind::keep)
+                    {
+                        append(line, true, change.left, change.count);
+                    }
+                    else if (change.kind == edit_kind::remove)
+                    {
+                        line += "[-";
+                        append(line, true, change.left, change.count);
+                        line += "-]";
+                    }
+                    else
+                    {
+                        line += "{+";
+                        append(line, false, change.right, change.count);
+                        line += "+}";
+                    }
+                }
+                if (j < script.size())
+                {
+                    const auto& keep = script[j];
+                    const std::size_t count = std::min(keep.count, context);
+                    line += separator;
+                    append(line, true, keep.left, count);
+                    if (count < keep.count)
+                        line += fmt::format("{}...", separator);
+                }
+
+                result += line;
+                hunks++;
+                i = j;
             }
-            fmt::println("");
+            return result;
         }
-        return numerrors;
+
+        void append_escaped(std::string& out, char c)
+        {
+            switch (c)
+            {
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if ((unsigned char)c < 0x20)
+                        out += fmt::format("\\x{:02x}", (int)(unsigned char)c);
+                    else
+                        out += c;
+            }
+        }
+    }
+
+    std::string diff(std::string_view left, std::string_view right)
+    {
+        const auto script = edit_script(left.size(), right.size()
+            , [&](std::size_t l, std::size_t r) { return left[l] == right[r]; });
+        return render_edit_script(script
+            , [&](std::string& out, bool from_left, std::size_t index) { append_escaped(out, from_left ? left[index] : right[index]); }
+            , "");
+    }
+
+    std::string diff(const std::vector<std::string>& left, const std::vector<std::string>& right)
+    {
+        const auto script = edit_script(left.size(), right.size()
+            , [&](std::size_t l, std::size_t r) { return left[l] == right[r]; });
+        return render_edit_script(script
+            , [&](std::string& out, bool from_left, std::size_t index) { out += from_left ? left[index] : right[index]; }
+            , ", ");
+    }
+
+    // ---------------------------------------- SECTION
+
+    void section::enter(const char* name) { suite::current_fixture()->push_section(name); }
+    void section::leave() { suite::current_fixture()->pop_section(); }
+
+    // ---------------------------------------- CONSTANT EVALUATION
+
+    void constexpr_assertion_failed(const char*) {}
+
+    void constexpr_verified(const char* file, int line)
+    {
+        fixture& fixture = *suite::current_fixture();
+        fixture.add_case();
+        fixture.add_result(
+              true
+            , (suite::ez_file(file) + ":" + std::to_string(line)).c_str()
+            , "", "constant evaluation", nullptr
+            , "(true)", nullptr
+        );
+    }
+
+    // ---------------------------------------- SAMPLED CHECKS
+
+    namespace
+    {
+        // Slots are written by whoever fails and read by whoever scrapes, each
+        // one is guarded by a sequence lock: odd while written, readers retry
+        // nothing and skip slots that changed under them. A writer finding its
+        // slot busy (the ring wrapped around meanwhile) drops its record
+        struct failure_slot
+        {
+            static constexpr std::size_t max_value = 56;
+
+            std::atomic<std::uint64_t> version = 0;
+            std::uint32_t site = 0;
+            std::uint64_t sequence = 0;
+            std::int64_t time = 0;
+            char left[max_value] = {};
+            char right[max_value] = {};
+        };
+
+        struct sampled_registry
+        {
+            static constexpr std::size_t capacity = 256;
+
+            static inline std::mutex mutex;
+            static inline std::atomic<sampled_site*> sites = nullptr;
+            static inline std::uint32_t next_id = 1;
+            static inline failure_slot slots[capacity] = {};
+            static inline std::atomic<std::uint64_t> head = 0;
+            static inline std::atomic<std::uint64_t> dropped = 0;
+
+            static void copy(char (&destination)[failure_slot::max_value], const std::string& value)
+            {
+                const std::size_t length = std::min(value.size(), failure_slot::max_value - 1);
+                std::memcpy(destination, value.data(), length);
+                destination[length] = '\0';
+            }
+        };
+    }
+
+    void register_sampled_site(sampled_site& site)
+    {
+        std::lock_guard lock(sampled_registry::mutex);
+        if (site.registered.load(std::memory_order_relaxed))
+            return;
+
+        site.id = sampled_registry::next_id++;
+        site.next = sampled_registry::sites.load(std::memory_order_relaxed);
+        sampled_registry::sites.store(&site, std::memory_order_release);
+        site.registered.store(true, std::memory_order_release);
+    }
+
+    void record_sampled_failure(sampled_site& site, const std::string& left, const std::string& right)
+    {
+        site.failed.fetch_add(1, std::memory_order_relaxed);
+
+        const std::uint64_t sequence = sampled_registry::head.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = sampled_registry::slots[sequence % sampled_registry::capacity];
+        std::uint64_t version = slot.version.load(std::memory_order_relaxed);
+        if ((version & 1) != 0 || !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+        {
+            sampled_registry::dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        slot.site = site.id;
+        slot.sequence = sequence;
+        slot.time = std::chrono::system_clock::now().time_since_epoch().count();
+        sampled_registry::copy(slot.left, left);
+        sampled_registry::copy(slot.right, right);
+        slot.version.store(version + 2, std::memory_order_release);
+    }
+
+    std::vector<sampled_counters> sampling::sites()
+    {
+        std::vector<sampled_counters> result;
+        for (auto site = sampled_registry::sites.load(std::memory_order_acquire); site; site = site->next)
+        {
+            result.push_back({ site->id, site->file, site->line, site->expression
+                , site->evaluated.load(std::memory_order_relaxed)
+                , site->failed.load(std::memory_order_relaxed) });
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+        return result;
+    }
+
+    std::vector<sampled_failure> sampling::failures()
+    {
+        std::vector<sampled_failure> result;
+        for (const auto& slot: sampled_registry::slots)
+        {
+            const std::uint64_t before = slot.version.load(std::memory_order_acquire);
+            if (before == 0 || (before & 1) != 0)
+                continue;
+
+            sampled_failure failure { slot.site, slot.sequence
+                , std::chrono::system_clock::time_point(std::chrono::system_clock::duration(slot.time))
+                , slot.left, slot.right };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.version.load(std::memory_order_relaxed) == before)
+                result.push_back(std::move(failure));
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.sequence < b.sequence; });
+        return result;
+    }
+
+    std::uint64_t sampling::dropped()
+    {
+        return sampled_registry::dropped.load(std::memory_order_relaxed);
+    }
+
+    std::string sampling::metrics()
+    {
+        const auto label = [](const sampled_counters& site)
+        {
+            std::string expression;
+            for (const char c: std::string_view(site.expression))
+            {
+                if (c == '"' || c == '\\') { expression += '\\'; expression += c; }
+                else if (c == '\n') { expression += "\\n"; }
+                else { expression += c; }
+            }
+            return fmt::format("{{id=\"{}\",site=\"{}:{}\",expression=\"{}\"}}"
+                , site.id, std::filesystem::path(site.file).filename().string(), site.line, expression);
+        };
+
+        const auto sites = sampling::sites();
+        std::string result = "# TYPE utest_sampled_evaluations_total counter\n";
+        for (const auto& site: sites)
+            result += fmt::format("utest_sampled_evaluations_total{} {}\n", label(site), site.evaluated);
+        result += "# TYPE utest_sampled_failures_total counter\n";
+        for (const auto& site: sites)
+            result += fmt::format("utest_sampled_failures_total{} {}\n", label(site), site.failed);
+        result += "# TYPE utest_sampled_dropped_failures_total counter\n";
+        result += fmt::format("utest_sampled_dropped_failures_total {}\n", dropped());
+        return result;
+    }
+
+    // ---------------------------------------- PROFILER
+
+    namespace
+    {
+        // Samples are written by the SIGPROF handler into a preallocated buffer,
+        // symbolization and folding only happen once the fixture is done
+        struct profile_sample
+        {
+            static constexpr int max_depth = 64;
+            int depth = 0;
+            void* frames[max_depth];
+        };
+
+        struct profiler
+        {
+            static constexpr std::size_t capacity = 1 << 14;
+            static inline std::vector<profile_sample> samples = {};
+            static inline std::atomic<std::size_t> count = 0;
+
+            // SIGPROF is process wide, a single session can profile at a time
+            static inline std::atomic<bool> busy = false;
+
+#ifdef UTEST_HAS_PROFILER
+            static inline struct sigaction previous_action = {};
+
+            // backtrace() is not async-signal-safe. Loaded beforehand by start(), the
+            // unwinder no longer allocates here, but without _dl_find_object (glibc
+            // before 2.35, libgcc before 12) it takes the loader's lock: a sample
+            // interrupting dlopen or the unwinding of an exception may deadlock
+            static void on_signal(int)
+            {
+                const int saved_errno = errno;
+                const std::size_t index = count.fetch_add(1, std::memory_order_relaxed);
+                if (index < capacity)
+                    samples[index].depth = backtrace(samples[index].frames, profile_sample::max_depth);
+                errno = saved_errno;
+            }
+
+            static std::string symbolize(void* address)
+            {
+                Dl_info info;
+                if (!dladdr(address, &info))
+                    return fmt::format("{}", address);
+
+                if (info.dli_sname)
+                {
+                    int status = 0;
+                    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                    std::string result = status == 0 ? demangled : info.dli_sname;
+                    std::free(demangled);
+                    return result;
+                }
+
+                const auto module = std::filesystem::path(info.dli_fname ? info.dli_fname : "?").filename().string();
+                return fmt::format("{}+{:#x}", module, (std::uintptr_t)address - (std::uintptr_t)info.dli_fbase);
+            }
+#endif
+
+            static void start(int frequency)
+            {
+#ifdef UTEST_HAS_PROFILER
+                if (samples.empty())
+                    samples.resize(capacity);
+
+                // The first backtrace() call loads libgcc and allocates, whatever
+                // the call, get that out of the way before a signal handler does it
+                static const int preloaded = []()
+                {
+                    void* frames[1];
+                    return backtrace(frames, 1);
+                }();
+                (void)preloaded;
+                count = 0;
+
+                struct sigaction action = {};
+                action.sa_handler = &on_signal;
+                action.sa_flags = SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGPROF, &action, &previous_action);
+
+                itimerval timer = {};
+                timer.it_interval.tv_sec = 0;
+                timer.it_interval.tv_usec = std::max(1, 1000000 / std::max(1, frequency));
+                timer.it_value = timer.it_interval;
+                setitimer(ITIMER_PROF, &timer, nullptr);
+#else
+                (void)frequency;
+#endif
+            }
+
+            static void stop()
+            {
+#ifdef UTEST_HAS_PROFILER
+                itimerval timer = {};
+                setitimer(ITIMER_PROF, &timer, nullptr);
+                sigaction(SIGPROF, &previous_action, nullptr);
+#endif
+            }
+
+            static void write(const fixture& fixture, const std::filesystem::path& root, std::FILE* output)
+            {
+#ifdef UTEST_HAS_PROFILER
+                // Skip the signal handler and the signal trampoline
+                static constexpr int skipped_frames = 2;
+
+                std::unordered_map<void*, std::string> symbols;
+                std::unordered_map<std::string, int> stacks;
+                const std::size_t sample_count = std::min(count.load(), capacity);
+                for (std::size_t i = 0; i < sample_count; i++)
+                {
+                    const auto& sample = samples[i];
+                    std::string stack;
+                    for (int f = sample.depth - 1; f >= skipped_frames; f--)
+                    {
+                        // Return addresses point after the call, step back into it
+                        // except for the interrupted instruction itself
+                        void* address = (char*)sample.frames[f] - (f > skipped_frames ? 1 : 0);
+                        auto it = symbols.find(address);
+                        if (it == symbols.end())
+                            it = symbols.emplace(address, symbolize(address)).first;
+
+                        if (!stack.empty())
+                            stack += ';';
+                        stack += it->second;
+                    }
+                    stacks[stack]++;
+                }
+
+                std::filesystem::create_directories(root);
+                const auto filepath = root / fmt::format("{}.{}.folded", fixture.group(), fixture.name());
+                std::ofstream file(filepath);
+                for (const auto& [stack, samplecount]: stacks)
+                    file << stack << ' ' << samplecount << '\n';
+
+                if (count.load() > capacity)
+                    fmt::println(output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow)
+                        , "-- profile buffer full, dropped {} samples", count.load() - capacity));
+#else
+                (void)fixture;
+                (void)root;
+                fmt::println(output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow)
+                    , "-- profiling is not supported on this platform"));
+#endif
+            }
+        };
     }
 
-    int suite::run(int argc, char** argv)
+    // ---------------------------------------- CAPTURE
+
+    namespace
     {
-        for (int i = 0; i < argc; i++)
+        // Standard output and error go to an in-memory file while a fixture
+        // runs; file descriptors are process wide, a single session can
+        // capture at a time
+        struct capture
         {
-            if ((!strcmp(argv[i], "--verbosity") || !strcmp(argv[i], "-v")) && i + 1 < argc)
+            static inline std::atomic<bool> busy = false;
+            static inline int fd = -1;
+            static inline int saved_stdout = -1;
+            static inline int saved_stderr = -1;
+
+            // Where utest itself keeps writing, the original standard output
+            static std::FILE* open_console()
+            {
+#ifdef UTEST_POSIX
+                if (busy.exchange(true))
+                    return nullptr;
+
+#ifdef __linux__
+                fd = memfd_create("utest_capture", MFD_CLOEXEC);
+#else
+                std::FILE* file = std::tmpfile();
+                fd = file ? dup(fileno(file)) : -1;
+                if (file)
+                    std::fclose(file);
+#endif
+                std::FILE* console = nullptr;
+                if (fd >= 0)
+                {
+                    std::fflush(stdout);
+                    const int console_fd = dup(STDOUT_FILENO);
+                    console = console_fd >= 0 ? fdopen(console_fd, "w") : nullptr;
+                }
+                if (!console)
+                {
+                    if (fd >= 0)
+                        ::close(fd);
+                    fd = -1;
+                    busy = false;
+                }
+                return console;
+#else
+                return nullptr;
+#endif
+            }
+
+            static void close_console(std::FILE* console)
+            {
+#ifdef UTEST_POSIX
+                std::fclose(console);
+                ::close(fd);
+                fd = -1;
+                busy = false;
+#else
+                (void)console;
+#endif
+            }
+
+            static void start()
+            {
+#ifdef UTEST_POSIX
+                std::fflush(stdout);
+                std::fflush(stderr);
+                saved_stdout = dup(STDOUT_FILENO);
+                saved_stderr = dup(STDERR_FILENO);
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+#endif
+            }
+
+            // Returns what was written since start, the buffer is emptied
+            static std::string stop()
             {
-                i++;
-                if (!strcmp(argv[i], "quiet")) { suite::config::verbosity = verbosity::quiet; }
-                if (!strcmp(argv[i], "failures")) { suite::config::verbosity = verbosity::failures; }
-                if (!strcmp(argv[i], "passed")) { suite::config::verbosity = verbosity::passed; }
-                if (!strcmp(argv[i], "everything")) { suite::config::verbosity = verbosity::everything; }
+                std::string captured;
+#ifdef UTEST_POSIX
+                std::fflush(stdout);
+                std::fflush(stderr);
+                dup2(saved_stdout, STDOUT_FILENO);
+                dup2(saved_stderr, STDERR_FILENO);
+                ::close(saved_stdout);
+                ::close(saved_stderr);
+
+                const off_t size = lseek(fd, 0, SEEK_END);
+                captured.resize(size > 0 ? std::size_t(size) : 0);
+                if (!captured.empty() && pread(fd, captured.data(), captured.size(), 0) != ssize_t(captured.size()))
+                    captured.clear();
+                if (ftruncate(fd, 0) != 0) {}
+                lseek(fd, 0, SEEK_SET);
+#endif
+                return captured;
             }
+        };
+    }
+
+    // ---------------------------------------- HOTSPOTS
+
+    namespace
+    {
+        std::string format_duration(std::chrono::duration<double, std::nano> time)
+        {
+            if (time.count() < 1e3)
+                return fmt::format("{:.1f}ns", time.count());
+            if (time.count() < 1e6)
+                return fmt::format("{:.1f}us", time.count() / 1e3);
+            return fmt::format("{:.1f}ms", time.count() / 1e6);
+        }
+
+        [[maybe_unused]] void print_hotspots(const session& session)
+        {
+            static constexpr std::size_t shown = 10;
 
-            if ((!strcmp(argv[i], "--source_root") || !strcmp(argv[i], "-s")) && i + 1 < argc)
+            // A file included by several translation units has several copies of its name
+            std::map<std::pair<std::string_view, int>, hotspot> merged;
+            for (const auto& [key, hotspot]: session.state->hotspots)
             {
-                i++;
-                suite::config::source_root = argv[i];
+                auto& total = merged.try_emplace({ hotspot.file, hotspot.line }, utest::hotspot { hotspot.file, hotspot.line }).first->second;
+                total.count += hotspot.count;
+                total.failures += hotspot.failures;
+                total.time += hotspot.time;
             }
+
+            std::vector<hotspot> sites;
+            for (const auto& [key, hotspot]: merged)
+                sites.push_back(hotspot);
+
+            const auto print = [&](const char* title, auto&& order)
+            {
+                std::sort(sites.begin(), sites.end(), order);
+                fmt::println(session.config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_blue), "-- hotspots by {}", title));
+                fmt::println(session.config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_black)
+                    , "\t{:>14} {:>10} {:>10} {:>10}  {}", "executions", "failures", "total", "per call", "call site"));
+                for (std::size_t i = 0; i < std::min(shown, sites.size()); i++)
+                {
+                    const auto& hotspot = sites[i];
+                    const auto file = session.ez_file(hotspot.file);
+                    fmt::println(session.config.output, "\t{:>14} {:>10} {:>10} {:>10}  {}:{}"
+                        , group_thousands((long long)hotspot.count), group_thousands((long long)hotspot.failures)
+                        , format_duration(hotspot.time), format_duration(hotspot.time / double(std::max<std::uint64_t>(1, hotspot.count)))
+                        , file.empty() ? hotspot.file : file, hotspot.line);
+                }
+            };
+            print("executions", [](const hotspot& a, const hotspot& b) { return a.count > b.count; });
+            print("framework time", [](const hotspot& a, const hotspot& b) { return a.time > b.time; });
         }
-        return runall();
     }
-}
\ No newline at end of file
+
+    // ---------------------------------------- SUITE
+
+    namespace
+    {
+        // Storage of the default session, constant initialized so that the
+        // references of suite into it are bound before any dynamic initializer
+        union default_storage
+        {
+            char none;
+            session instance;
+
+            constexpr default_storage() : none() {}
+            ~default_storage() {}
+        };
+
+        constinit default_storage default_storage_instance;
+    }
+
+    session& suite::default_session()
+    {
+        // Constructed by the first fixture, thus destroyed after all of them
+        static const struct lifetime
+        {
+            lifetime() { std::construct_at(&default_storage_instance.instance); }
+            ~lifetime() { std::destroy_at(&default_storage_instance.instance); }
+        } constructed;
+        return default_storage_instance.instance;
+    }
+
+    namespace
+    {
+        // Before the dynamic initializers of other translation units, which may
+        // set suite::config; a module loaded earlier has default_session() do it
+        struct default_session_constructor
+        {
+            default_session_constructor() { suite::default_session(); }
+        };
+
+#if defined(__GNUC__)
+        __attribute__((init_priority(101)))
+#endif
+        default_session_constructor construct_default_session;
+    }
+
+    constinit utest::verbosity& suite::config::verbosity = default_storage_instance.instance.config.verbosity;
+    constinit std::filesystem::path& suite::config::source_root = default_storage_instance.instance.config.source_root;
+    constinit std::filesystem::path& suite::config::profile_root = default_storage_instance.instance.config.profile_root;
+    constinit int& suite::config::profile_frequency = default_storage_instance.instance.config.profile_frequency;
+    constinit std::filesystem::path& suite::config::trace_path = default_storage_instance.instance.config.trace_path;
+    constinit std::filesystem::path& suite::config::journal_path = default_storage_instance.instance.config.journal_path;
+    constinit std::filesystem::path& suite::config::resume_path = default_storage_instance.instance.config.resume_path;
+    constinit std::vector<std::string>& suite::config::filters = default_storage_instance.instance.config.filters;
+    constinit std::vector<std::string>& suite::config::tags = default_storage_instance.instance.config.tags;
+    constinit bool& suite::config::capture = default_storage_instance.instance.config.capture;
+    constinit int& suite::config::max_failures = default_storage_instance.instance.config.max_failures;
+    constinit bool& suite::config::hotspots = default_storage_instance.instance.config.hotspots;
+    constinit std::filesystem::path& suite::config::temp_root = default_storage_instance.instance.config.temp_root;
+    constinit bool& suite::config::keep_temp = default_storage_instance.instance.config.keep_temp;
+    constinit std::filesystem::path& suite::config::corpus_root = default_storage_instance.instance.config.corpus_root;
+    constinit std::chrono::seconds& suite::config::fuzz_time = default_storage_instance.instance.config.fuzz_time;
+    constinit std::uint64_t& suite::config::fuzz_runs = default_storage_instance.instance.config.fuzz_runs;
+    constinit std::size_t& suite::config::fuzz_max_length = default_storage_instance.instance.config.fuzz_max_length;
+    constinit std::vector<fixture*>& suite::fixtures = default_storage_instance.instance.fixtures;
+
+    fixture* suite::unscoped_fixture()
+    {
+        if (session* sole = running_sessions::sole.load())
+            return sole->latest.load(std::memory_order_relaxed);
+
+        std::unique_lock lock(running_sessions::mutex);
+        if (running_sessions::sessions.empty())
+            return default_session().latest.load(std::memory_order_relaxed);
+        lock.unlock();
+
+        // Guessing would report into the fixture of another session
+        fmt::println(stderr, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red)
+            , "-- assertion on a thread without fixture while several sessions run, see utest::thread_scope"));
+        std::abort();
+    }
+
+    std::string suite::ez_file(const char* filepath)
+    {
+        const fixture* fixture = current_fixture();
+        return (fixture ? *fixture->owner : default_session()).ez_file(filepath);
+    }
+
+    session::session()
+        : state(std::make_unique<session_state>()) {}
+
+    session::~session() = default;
+
+    std::string session::ez_file(const char* filepath) const
+    {
+        std::filesystem::path fp(filepath);
+        return std::filesystem::relative(fp, config.source_root).string();
+    }
+
+    bool session::selected(const fixture& fixture) const
+    {
+        const auto& required = state->required_tags;
+        const auto& forbidden = state->forbidden_tags;
+        if (!required.empty() || !forbidden.empty())
+        {
+            const auto& bits = tag_bits(*state, fixture);
+            for (std::size_t i = 0; i < required.size(); i++)
+            {
+                if (((i < bits.size() ? bits[i] : 0) & required[i]) != required[i])
+                    return false;
+            }
+            for (std::size_t i = 0; i < std::min(forbidden.size(), bits.size()); i++)
+            {
+                if (bits[i] & forbidden[i])
+                    return false;
+            }
+        }
+
+        if (config.filters.empty())
+            return true;
+
+        const auto fullname = fmt::format("{}.{}", fixture.group(), fixture.name());
+        return std::any_of(config.filters.begin(), config.filters.end()
+            , [&](const std::string& filter) { return glob_match(filter, fullname); });
+    }
+
+    void session::compile_tags()
+    {
+        state->required_tags.clear();
+        state->forbidden_tags.clear();
+        for (std::string_view tag: config.tags)
+        {
+            const bool forbidden = tag.starts_with('!');
+            set_bit(forbidden ? state->forbidden_tags : state->required_tags, intern_tag(*state, tag.substr(forbidden)));
+        }
+    }
+
+    namespace
+    {
+        // Fixtures in registration order, each after the fixtures it depends on
+        struct fixture_order
+        {
+            std::vector<fixture*> fixtures = {};
+            std::unordered_map<const fixture*, std::vector<const fixture*>> dependencies = {};
+            std::string error = {};
+        };
+
+        fixture_order order_fixtures(const std::vector<fixture*>& fixtures)
+        {
+            fixture_order result;
+            const auto fullname = [&](std::size_t index) { return fmt::format("{}.{}", fixtures[index]->group(), fixtures[index]->name()); };
+
+            std::unordered_map<std::string, std::size_t> indices;
+            for (std::size_t index = 0; index < fixtures.size(); index++)
+                indices.try_emplace(fullname(index), index);
+
+            std::vector<std::vector<std::size_t>> dependencies(fixtures.size());
+            std::vector<std::vector<std::size_t>> dependents(fixtures.size());
+            std::vector<std::size_t> waiting(fixtures.size(), 0);
+            for (std::size_t index = 0; index < fixtures.size(); index++)
+            {
+                for (const auto name: split_list(fixtures[index]->attributes().depends))
+                {
+                    const auto it = indices.find(std::string(name));
+                    if (it == indices.end())
+                    {
+                        result.error = fmt::format("{} depends on unknown fixture {}", fullname(index), name);
+                        return result;
+                    }
+                    dependencies[index].push_back(it->second);
+                    dependents[it->second].push_back(index);
+                    waiting[index]++;
+                    result.dependencies[fixtures[index]].push_back(fixtures[it->second]);
+                }
+            }
+
+            // Kahn's algorithm, the earliest registered of the ready fixtures goes first
+            std::priority_queue<std::size_t, std::vector<std::size_t>, std::greater<>> ready;
+            for (std::size_t index = 0; index < fixtures.size(); index++)
+            {
+                if (waiting[index] == 0)
+                    ready.push(index);
+            }
+            while (!ready.empty())
+            {
+                const std::size_t index = ready.top();
+                ready.pop();
+                result.fixtures.push_back(fixtures[index]);
+                for (const std::size_t dependent: dependents[index])
+                {
+                    if (--waiting[dependent] == 0)
+                        ready.push(dependent);
+                }
+            }
+
+            if (result.fixtures.size() < fixtures.size())
+            {
+                // Fixtures left behind wait on one another, following what they
+                // wait on from any of them ends up going round a cycle
+                std::size_t index = std::size_t(std::find_if(waiting.begin(), waiting.end(), [](std::size_t count) { return count > 0; }) - waiting.begin());
+                std::vector<std::size_t> path;
+                std::vector<std::size_t> position(fixtures.size(), path.max_size());
+                while (position[index] == path.max_size())
+                {
+                    position[index] = path.size();
+                    path.push_back(index);
+                    index = *std::find_if(dependencies[index].begin(), dependencies[index].end(), [&](std::size_t dependency) { return waiting[dependency] > 0; });
+                }
+
+                result.error = "dependency cycle: ";
+                for (std::size_t i = position[index]; i < path.size(); i++)
+                    result.error += fullname(path[i]) + " -> ";
+                result.error += fullname(index);
+            }
+            return result;
+        }
+    }
+
+    int session::list()
+    {
+        if (const auto order = order_fixtures(fixtures); !order.error.empty())
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- {}", order.error));
+            return 1;
+        }
+
+        // Attributes follow the name, tab separated, for utest_runner
+        compile_tags();
+        for (const auto fixture: fixtures)
+        {
+            if (!selected(*fixture))
+                continue;
+
+            const auto& attributes = fixture->attributes();
+            std::string line = fmt::format("{}.{}", fixture->group(), fixture->name());
+            if (attributes.tags[0] != '\0')
+                line += fmt::format("\ttags={}", attributes.tags);
+            if (attributes.cost.count() > 0)
+                line += fmt::format("\tcost={}", attributes.cost.count());
+            if (attributes.depends[0] != '\0')
+                line += fmt::format("\tdepends={}", attributes.depends);
+            if (attributes.cpus != 1)
+                line += fmt::format("\tcpus={}", attributes.cpus);
+            if (attributes.memory > 0)
+                line += fmt::format("\tmemory={}", attributes.memory);
+            if (attributes.exclusive)
+                line += "\texclusive=1";
+            fmt::println(config.output, "{}", line);
+        }
+        return 0;
+    }
+
+    int session::runall()
+    {
+        // Rejected before anything runs, a cycle is a mistake of the test code
+        const auto order = order_fixtures(fixtures);
+        if (!order.error.empty())
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- {}", order.error));
+            return 1;
+        }
+        compile_tags();
+        const running_scope running(*this);
+
+        int numpassed = 0;
+        int numtests = 0;
+        int numcases = 0;
+        int numerrors = 0;
+        std::unordered_set<const fixture*> passed;
+        std::vector<const fixture*> skipped;
+
+        auto& trace = state->trace;
+        auto& journal = state->journal;
+        trace.enabled = !config.trace_path.empty();
+        state->hotspots.clear();
+
+        // Fixtures a previous run finished keep their results and are not run
+        // again, the journal being resumed keeps growing unless told otherwise
+        std::unordered_map<std::string, journal_entry> resumed;
+        if (!config.resume_path.empty())
+        {
+            for (auto& entry: journal::read(config.resume_path))
+                if (entry.finished)
+                    resumed[entry.fixture] = std::move(entry);
+            if (config.journal_path.empty())
+                config.journal_path = config.resume_path;
+        }
+        const bool append_journal = !config.resume_path.empty() && config.journal_path == config.resume_path;
+
+        // Fixtures write to the capture, utest to a copy of the standard output
+        std::FILE* const saved_output = config.output;
+        std::FILE* const console = config.capture ? capture::open_console() : nullptr;
+        if (console && config.output == stdout)
+            config.output = console;
+        if (config.capture && !console)
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- output is not captured, capture unavailable or in use"));
+
+        if (!config.journal_path.empty())
+        {
+            // Whoever ran before us with the same journal may have crashed
+            for (const auto& entry: journal::read(config.journal_path))
+                if (!entry.finished && !resumed.contains(entry.fixture))
+                    fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- previous run did not finish {}", entry.fixture));
+            if (!journal.open(config.journal_path, append_journal))
+                fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- could not open journal {}", config.journal_path.string()));
+        }
+
+        for (auto fixture: order.fixtures)
+        {
+            if (!selected(*fixture))
+                continue;
+
+            // Dependencies come first, unless they are not selected
+            if (const auto it = order.dependencies.find(fixture); it != order.dependencies.end())
+            {
+                const auto& dependencies = it->second;
+                const auto failed = std::find_if(dependencies.begin(), dependencies.end()
+                    , [&](const utest::fixture* dependency) { return selected(*dependency) && !passed.contains(dependency); });
+                if (failed != dependencies.end())
+                {
+                    if (config.verbosity > verbosity::silent)
+                    {
+                        fmt::println(config.output, "{} -> {} {}"
+                            , fmt::format(fmt::fg(fmt::terminal_color::bright_blue), "-- {}.{}", fixture->group(), fixture->name())
+                            , fmt::format(fmt::fg(fmt::terminal_color::yellow), "skipped")
+                            , fmt::format(fmt::fg(fmt::terminal_color::bright_black), "({}.{} did not pass)", (*failed)->group(), (*failed)->name()));
+                    }
+                    skipped.push_back(fixture);
+                    continue;
+                }
+            }
+
+            suite::current = fixture;
+            latest = fixture;
+            if (auto it = resumed.find(fmt::format("{}.{}", fixture->group(), fixture->name())); it != resumed.end())
+            {
+                const auto& entry = it->second;
+                fixture->cases = entry.cases;
+                fixture->errors = entry.errors;
+                fixture->duration = entry.duration;
+                if (config.verbosity > verbosity::silent)
+                {
+                    auto style = fmt::fg(entry.errors == 0 ? fmt::terminal_color::green : fmt::terminal_color::bright_red);
+                    fmt::println(config.output, "{} -> {} {} {}"
+                        , fmt::format(fmt::fg(fmt::terminal_color::bright_blue), "-- {}", entry.fixture)
+                        , fmt::format(style, "{}", entry.errors == 0 ? "passed" : "failed")
+                        , fmt::format("[{}/{}]", entry.cases - entry.errors, entry.cases)
+                        , fmt::format(fmt::fg(fmt::terminal_color::bright_black), "(resumed)"));
+                }
+                if (journal.enabled && !append_journal)
+                {
+                    journal.started(*fixture);
+                    journal.finished(*fixture);
+                }
+                numtests++;
+                numcases += fixture->cases;
+                numerrors += fixture->errors;
+                if (fixture->errors == 0)
+                {
+                    numpassed++;
+                    passed.insert(fixture);
+                }
+                continue;
+            }
+
+            if (trace.enabled)
+                trace.record(trace_kind::fixture, fixture, 'B');
+            if (journal.enabled)
+                journal.started(*fixture);
+            fixture->setup();
+            if (console)
+            {
+                // What was printed so far must survive a crash of the fixture
+                std::fflush(config.output);
+                capture::start();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            if (!config.profile_root.empty() && !profiler::busy.exchange(true))
+            {
+                profiler::start(config.profile_frequency);
+                fixture->run();
+                profiler::stop();
+                fixture->duration = std::chrono::steady_clock::now() - start;
+                profiler::busy = false;
+                profiler::write(*fixture, config.profile_root, config.output);
+            }
+            else
+            {
+                fixture->run();
+                fixture->duration = std::chrono::steady_clock::now() - start;
+            }
+            fixture->join_thread_counts();
+            if (console)
+            {
+                const auto captured = capture::stop();
+                if (fixture->errors > 0 && !captured.empty() && config.verbosity > verbosity::quiet)
+                    fixture->print_captured(captured);
+            }
+            fixture->teardown();
+            if (journal.enabled)
+                journal.finished(*fixture);
+            if (trace.enabled)
+                trace.record(trace_kind::fixture, fixture, 'E');
+            numtests++;
+            numcases += fixture->cases;
+            numerrors += fixture->errors;
+            if (fixture->errors == 0)
+            {
+                numpassed++;
+                passed.insert(fixture);
+            }
+        }
+
+        suite::current = nullptr;
+        if (trace.enabled)
+            trace.write(config.trace_path);
+        if (journal.enabled)
+        {
+            journal.ended(numtests, numerrors);
+            journal.close();
+        }
+
+        if (config.hotspots && config.verbosity > verbosity::silent)
+        {
+#if defined(UTEST_HOTSPOTS)
+            print_hotspots(*this);
+#else
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- no hotspots, assertions are only accounted when built with UTEST_HOTSPOTS"));
+#endif
+        }
+
+        if (numpassed != numtests && config.verbosity > verbosity::silent)
+        {
+            auto style = fmt::fg(fmt::terminal_color::bright_red);
+            fmt::println(config.output, "--------------------------");
+            fmt::print(config.output, style, "-> some tests have failed: ");
+            int pindex = 0;
+            for (const auto& fixture: fixtures)
+            {
+                if (fixture->errors == 0)
+                    continue;
+
+                fmt::print(config.output, "{}.{} ({})", fixture->group(), fixture->name(), fixture->errors);
+                if ((numtests - numpassed) > (pindex + 2))
+                    fmt::print(config.output, ", ");
+                else if ((numtests - numpassed) > (pindex + 1))
+                    fmt::print(config.output, " & ");
+
+                pindex++;
+            }
+            fmt::println(config.output, "");
+        }
+
+        if (!skipped.empty() && config.verbosity > verbosity::silent)
+        {
+            fmt::print(config.output, fmt::fg(fmt::terminal_color::yellow), "-> skipped: ");
+            for (std::size_t i = 0; i < skipped.size(); i++)
+                fmt::print(config.output, "{}{}.{}", i > 0 ? ", " : "", skipped[i]->group(), skipped[i]->name());
+            fmt::println(config.output, "");
+        }
+
+        if (console)
+        {
+            config.output = saved_output;
+            capture::close_console(console);
+        }
+        return numerrors;
+    }
+
+    // ---------------------------------------- SELF TEST
+
+    self_test_result session::self_test(std::string_view tag, std::chrono::microseconds budget)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        const running_scope running(*this);
+
+        // Without a tag every fixture is selected, and nothing is interned
+        const std::size_t id = tag.empty() ? 0 : intern_tag(*state, tag);
+        std::vector<fixture*> selection;
+        for (auto fixture: fixtures)
+        {
+            const auto& bits = tag_bits(*state, *fixture);
+            if (tag.empty() || (id / 64 < bits.size() && (bits[id / 64] >> (id % 64)) & 1))
+                selection.push_back(fixture);
+        }
+
+        // Once the budget runs out, the heaviest fixtures are the ones left
+        std::stable_sort(selection.begin(), selection.end()
+            , [](const fixture* a, const fixture* b) { return a->attributes().cost < b->attributes().cost; });
+
+        const auto saved_verbosity = config.verbosity;
+        config.verbosity = verbosity::silent;
+
+        self_test_result result;
+        const auto start = std::chrono::steady_clock::now();
+        for (auto fixture: selection)
+        {
+            auto& entry = result.fixtures.emplace_back(self_test_entry { fmt::format("{}.{}", fixture->group(), fixture->name()) });
+            const auto elapsed = duration_cast<microseconds>(std::chrono::steady_clock::now() - start);
+            if (elapsed + fixture->attributes().cost > budget)
+            {
+                result.skipped++;
+                continue;
+            }
+
+            fixture->reset();
+            suite::current = fixture;
+            latest = fixture;
+            const auto fixture_start = std::chrono::steady_clock::now();
+            try
+            {
+                fixture->run();
+            }
+            catch (const std::exception& exception)
+            {
+                fixture->errors++;
+                fixture->first_failure = fmt::format("exception: {}", exception.what());
+            }
+            catch (...)
+            {
+                fixture->errors++;
+                fixture->first_failure = "unknown exception";
+            }
+            fixture->join_thread_counts();
+            fixture->duration = std::chrono::steady_clock::now() - fixture_start;
+
+            entry.result = fixture->errors == 0 ? outcome::passed : outcome::failed;
+            entry.cases = fixture->cases;
+            entry.errors = fixture->errors;
+            entry.duration = duration_cast<microseconds>(fixture->duration);
+            entry.failure = fixture->first_failure;
+            (fixture->errors == 0 ? result.passed : result.failed)++;
+
+            // Leaves nothing behind for regular runs
+            fixture->reset();
+        }
+        suite::current = nullptr;
+        config.verbosity = saved_verbosity;
+        result.elapsed = duration_cast<microseconds>(std::chrono::steady_clock::now() - start);
+        return result;
+    }
+
+    // ---------------------------------------- FUZZ
+
+    namespace
+    {
+        // Hit counts of the edges of the code built with
+        // -fsanitize-coverage=trace-pc-guard, each guard holds its index
+        struct coverage
+        {
+#ifdef UTEST_FUZZ
+            static constexpr std::size_t capacity = 1 << 20;
+#else
+            static constexpr std::size_t capacity = 1;
+#endif
+            static inline std::uint32_t guards = 0;
+            static inline std::uint8_t counters[capacity] = {};
+
+            static void clear() { std::memset(counters, 0, std::min<std::size_t>(guards + 1, capacity)); }
+
+            // Hit counts are bucketed as 1, 2, 3, 4-7, 8-15, 16-31, 32-127 and
+            // 128+, an input is interesting when it reaches a bucket never seen
+            static bool merge(std::vector<std::uint8_t>& seen)
+            {
+                static constexpr auto buckets = []()
+                {
+                    std::array<std::uint8_t, 256> result = {};
+                    for (int count = 1; count < 256; count++)
+                        result[count] = std::uint8_t(1 << (count < 4 ? count - 1 : count < 8 ? 3 : count < 16 ? 4 : count < 32 ? 5 : count < 128 ? 6 : 7));
+                    return result;
+                }();
+
+                const std::size_t size = std::min<std::size_t>(guards + 1, capacity);
+                seen.resize(capacity);
+                bool discovered = false;
+                for (std::size_t index = 0; index < size; index++)
+                {
+                    const std::uint8_t bucket = buckets[counters[index]];
+                    if (bucket & ~seen[index])
+                    {
+                        seen[index] |= bucket;
+                        discovered = true;
+                    }
+                }
+                return discovered;
+            }
+
+            static std::size_t edges(const std::vector<std::uint8_t>& seen)
+            {
+                return std::size_t(std::count_if(seen.begin(), seen.end(), [](std::uint8_t bits) { return bits != 0; }));
+            }
+        };
+
+        // Read-only view of a corpus file, mapped when possible
+        struct mapped_file
+        {
+            const std::uint8_t* data = nullptr;
+            std::size_t size = 0;
+            std::vector<std::uint8_t> buffer = {};
+            bool mapped = false;
+
+            explicit mapped_file(const std::filesystem::path& path)
+            {
+#ifdef UTEST_POSIX
+                const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd >= 0)
+                {
+                    const off_t length = lseek(fd, 0, SEEK_END);
+                    void* address = length > 0 ? mmap(nullptr, std::size_t(length), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+                    ::close(fd);
+                    if (address != MAP_FAILED)
+                    {
+                        data = static_cast<const std::uint8_t*>(address);
+                        size = std::size_t(length);
+                        mapped = true;
+                        return;
+                    }
+                }
+#endif
+                std::ifstream file(path, std::ios::binary);
+                buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                data = buffer.data();
+                size = buffer.size();
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            ~mapped_file()
+            {
+#ifdef UTEST_POSIX
+                if (mapped)
+                    munmap(const_cast<std::uint8_t*>(data), size);
+#endif
+            }
+        };
+
+        // Harnesses may look at the pointer even for empty inputs
+        constexpr std::uint8_t empty_input[1] = {};
+
+        std::filesystem::path corpus_path(const fixture& fixture)
+        {
+            return fixture.owner->config.corpus_root / fmt::format("{}.{}", fixture.group(), fixture.name());
+        }
+
+        // Reproducers saved by --fuzz are kept next to the corpus, not replayed
+        bool is_reproducer(const std::filesystem::path& path)
+        {
+            const auto filename = path.filename().string();
+            return filename.starts_with("failure-") || filename.starts_with("crash-");
+        }
+
+        std::vector<std::filesystem::path> corpus_files(const fixture& fixture)
+        {
+            std::vector<std::filesystem::path> files;
+            std::error_code error;
+            for (const auto& entry: std::filesystem::directory_iterator(corpus_path(fixture), error))
+            {
+                if (entry.is_regular_file(error) && !is_reproducer(entry.path()))
+                    files.push_back(entry.path());
+            }
+            std::sort(files.begin(), files.end());
+            return files;
+        }
+
+        // Stands for the fuzz fixture on a replay thread, in a session of its
+        // own so that nothing but the harness is shared between threads: its
+        // output and journal records are handed to the parent once joined
+        struct replay_fixture final : fixture
+        {
+            fuzz_fixture& parent;
+
+            replay_fixture(session& owner, fuzz_fixture& parent)
+                : fixture(owner), parent(parent) {}
+
+            const char* name() const override { return parent.name(); }
+            const char* group() const override { return parent.group(); }
+            void run() override {}
+        };
+
+        struct replay_worker
+        {
+            utest::session session;
+            replay_fixture replayed;
+            std::exception_ptr exception = {};
+
+            // Without an output of its own, the worker prints straight to the parent's
+            replay_worker(const utest::session& owner, fuzz_fixture& parent, std::FILE* output)
+                : replayed(session, parent)
+            {
+                session.config = owner.config;
+                session.config.output = output ? output : owner.config.output;
+                session.config.hotspots = false;
+                session.config.capture = false;
+                session.state->journal.enabled = owner.state->journal.enabled;
+                session.state->journal.buffered = true;
+
+                // The parent prints the line break before the first failure
+                replayed.printed_something = output || parent.printed_something;
+            }
+
+            bool owns_output() const { return session.config.output != replayed.parent.owner->config.output; }
+
+            ~replay_worker()
+            {
+                if (owns_output())
+                    std::fclose(session.config.output);
+            }
+        };
+
+        std::uint64_t fnv1a(const std::uint8_t* data, std::size_t size)
+        {
+            std::uint64_t hash = 0xcbf29ce484222325ull;
+            for (std::size_t i = 0; i < size; i++)
+                hash = (hash ^ data[i]) * 0x100000001b3ull;
+            return hash;
+        }
+
+        // Writes the input under a name derived from its content, using nothing
+        // but async-signal-safe calls as it also runs from the crash handler
+        void save_input(const char* directory, const char* prefix, const std::uint8_t* data, std::size_t size)
+        {
+#ifdef UTEST_POSIX
+            char path[4096];
+            std::size_t length = 0;
+            for (const char* part: { directory, "/", prefix })
+            {
+                for (; *part && length + 17 < sizeof(path); part++)
+                    path[length++] = *part;
+            }
+            const std::uint64_t hash = fnv1a(data, size);
+            for (int shift = 60; shift >= 0; shift -= 4)
+                path[length++] = "0123456789abcdef"[(hash >> shift) & 0xf];
+            path[length] = '\0';
+
+            const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return;
+            for (std::size_t written = 0; written < size;)
+            {
+                const ssize_t count = write(fd, data + written, size - written);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    break;
+                written += std::size_t(count);
+            }
+            ::close(fd);
+#else
+            std::ofstream file(fmt::format("{}/{}{:016x}", directory, prefix, fnv1a(data, size)), std::ios::binary);
+            file.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+#endif
+        }
+
+        // The input being fuzzed is saved when the harness crashes the process
+        struct crash_handler
+        {
+            static inline std::string directory = {};
+            // Per thread, corpus replays run on several
+            static inline thread_local const std::uint8_t* input = nullptr;
+            static inline thread_local std::size_t input_size = 0;
+
+#ifdef UTEST_POSIX
+            static constexpr int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+            static inline struct sigaction previous_actions[std::size(signals)] = {};
+
+            static void on_signal(int signal)
+            {
+                if (input)
+                    save_input(directory.c_str(), "crash-", input, input_size);
+                stop();
+                raise(signal);
+            }
+#endif
+
+            static void start(const std::filesystem::path& path)
+            {
+                directory = path.string();
+#ifdef UTEST_POSIX
+                struct sigaction action = {};
+                action.sa_handler = &on_signal;
+                sigemptyset(&action.sa_mask);
+                for (std::size_t i = 0; i < std::size(signals); i++)
+                    sigaction(signals[i], &action, &previous_actions[i]);
+#endif
+            }
+
+            static void stop()
+            {
+#ifdef UTEST_POSIX
+                for (std::size_t i = 0; i < std::size(signals); i++)
+                    sigaction(signals[i], &previous_actions[i], nullptr);
+#endif
+                input = nullptr;
+            }
+
+            // The input this thread runs, saved if it crashes
+            static void arm(const std::uint8_t* data, std::size_t size)
+            {
+                input = data;
+                input_size = size;
+            }
+
+            static void disarm() { input = nullptr; }
+        };
+
+        struct mutator
+        {
+            std::mt19937_64 random { std::random_device{}() };
+            std::size_t max_length;
+
+            std::size_t below(std::size_t bound) { return bound == 0 ? 0 : std::size_t(random() % bound); }
+
+            void mutate(std::vector<std::uint8_t>& input, const std::vector<std::vector<std::uint8_t>>& corpus)
+            {
+                static constexpr std::uint8_t interesting[] = { 0, 1, 0x7f, 0x80, 0xff, '0', '9', 'a', ' ', '\n', '"', '{', '}', '[', ']', ',' };
+
+                // A handful of stacked mutations explores further than single ones
+                for (int count = 1 + int(below(4)); count > 0; count--)
+                {
+                    const std::size_t position = below(input.size());
+                    switch (input.empty() ? 2 : below(7))
+                    {
+                    case 0:
+                        input[position] ^= std::uint8_t(1 << below(8));
+                        break;
+                    case 1:
+                        input[position] = std::uint8_t(random());
+                        break;
+                    case 2:
+                        input.insert(input.begin() + std::ptrdiff_t(below(input.size() + 1)), 1 + below(8), std::uint8_t(random()));
+                        break;
+                    case 3:
+                        input.erase(input.begin() + std::ptrdiff_t(position), input.begin() + std::ptrdiff_t(position + 1 + below(std::min<std::size_t>(8, input.size() - position))));
+                        break;
+                    case 4:
+                    {
+                        const std::size_t length = 1 + below(std::min<std::size_t>(16, input.size() - position));
+                        const std::vector<std::uint8_t> chunk(input.begin() + std::ptrdiff_t(position), input.begin() + std::ptrdiff_t(position + length));
+                        input.insert(input.begin() + std::ptrdiff_t(below(input.size() + 1)), chunk.begin(), chunk.end());
+                        break;
+                    }
+                    case 5:
+                    {
+                        const auto& other = corpus[below(corpus.size())];
+                        if (other.empty())
+                            break;
+                        const std::size_t from = below(other.size());
+                        const std::size_t length = 1 + below(std::min<std::size_t>(32, other.size() - from));
+                        input.insert(input.begin() + std::ptrdiff_t(below(input.size() + 1)), other.begin() + std::ptrdiff_t(from), other.begin() + std::ptrdiff_t(from + length));
+                        break;
+                    }
+                    default:
+                        input[position] = interesting[below(std::size(interesting))];
+                        break;
+                    }
+                }
+                if (input.size() > max_length)
+                    input.resize(max_length);
+            }
+        };
+    }
+
+    void fuzz_fixture::run()
+    {
+        const auto files = corpus_files(*this);
+        if (files.empty())
+        {
+            fuzz(empty_input, 0);
+            return;
+        }
+
+        // Each thread replays a contiguous slice of the corpus into its own file,
+        // so failures are reported in the order of the files whatever the
+        // scheduling; short of files, a single thread replays the whole corpus
+        std::size_t count = std::min<std::size_t>(files.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::unique_ptr<replay_worker>> workers;
+        for (std::size_t index = 0; index < count; index++)
+        {
+            std::FILE* output = std::tmpfile();
+            if (!output)
+            {
+                if (owner->config.verbosity > verbosity::silent)
+                {
+                    if (!printed_something)
+                    {
+                        fmt::println(owner->config.output, "");
+                        printed_something = true;
+                    }
+                    fmt::println(owner->config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- could not buffer the replay output, replaying on a single thread"));
+                }
+                workers.clear();
+                count = 1;
+                workers.emplace_back(std::make_unique<replay_worker>(*owner, *this, nullptr));
+                break;
+            }
+            workers.emplace_back(std::make_unique<replay_worker>(*owner, *this, output));
+        }
+
+        // A crashing file is saved as a reproducer, the way --fuzz saves its inputs
+        crash_handler::start(corpus_path(*this));
+        std::vector<std::thread> threads;
+        for (std::size_t index = 0; index < count; index++)
+        {
+            auto& worker = *workers[index];
+            const std::size_t begin = index * files.size() / count;
+            const std::size_t end = (index + 1) * files.size() / count;
+            threads.emplace_back([&worker, &files, begin, end, this]()
+            {
+                suite::current = &worker.replayed;
+                try
+                {
+                    for (std::size_t i = begin; i < end; i++)
+                    {
+                        const mapped_file input(files[i]);
+                        worker.replayed.push_section(files[i].filename().string().c_str());
+                        crash_handler::arm(input.size ? input.data : empty_input, input.size);
+                        fuzz(input.size ? input.data : empty_input, input.size);
+                        crash_handler::disarm();
+                        worker.replayed.pop_section();
+                    }
+                }
+                catch (...)
+                {
+                    worker.exception = std::current_exception();
+                }
+                crash_handler::disarm();
+                suite::current = nullptr;
+            });
+        }
+        for (auto& thread: threads)
+            thread.join();
+        crash_handler::stop();
+
+        std::exception_ptr exception;
+        for (auto& worker: workers)
+        {
+            auto& replayed = worker->replayed;
+            replayed.join_thread_counts();
+            if (owner->config.verbosity > verbosity::quiet)
+                replayed.print_repeated_failures();
+
+            std::FILE* output = worker->session.config.output;
+            if (worker->owns_output() && std::ftell(output) > 0)
+            {
+                if (!printed_something)
+                {
+                    fmt::println(owner->config.output, "");
+                    printed_something = true;
+                }
+                std::rewind(output);
+                char buffer[4096];
+                for (std::size_t read; (read = std::fread(buffer, 1, sizeof(buffer), output)) > 0;)
+                    std::fwrite(buffer, 1, read, owner->config.output);
+            }
+
+            if (!worker->owns_output())
+                printed_something = replayed.printed_something;
+            if (auto& journal = owner->state->journal; journal.enabled)
+                journal.append(worker->session.state->journal.buffer);
+
+            cases += replayed.cases;
+            caseindex += replayed.caseindex;
+            errors += replayed.errors;
+            for (const auto& node: replayed.sections.nodes)
+            {
+                sections.node->passed += node.passed;
+                sections.node->failed += node.failed;
+            }
+            if (first_failure.empty())
+                first_failure = replayed.first_failure;
+            if (!exception)
+                exception = worker->exception;
+        }
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    int session::fuzz(std::string_view fixture_name)
+    {
+        const auto it = std::find_if(fixtures.begin(), fixtures.end()
+            , [&](const fixture* fixture) { return fmt::format("{}.{}", fixture->group(), fixture->name()) == fixture_name; });
+        auto* target = it != fixtures.end() ? dynamic_cast<fuzz_fixture*>(*it) : nullptr;
+        if (!target)
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- no test_fuzz fixture named {}", fixture_name));
+            return 1;
+        }
+
+        const running_scope running(*this);
+        const auto directory = corpus_path(*target);
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+#ifndef UTEST_FUZZ
+        fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- utest is built without UTEST_FUZZ, mutations are not guided by coverage"));
+#endif
+
+        // Runs silently, only the input that fails is run again to show why
+        const auto saved_verbosity = config.verbosity;
+        config.verbosity = verbosity::silent;
+        std::vector<std::uint8_t> seen;
+        const auto execute = [&](const std::vector<std::uint8_t>& input)
+        {
+            target->reset();
+            suite::current = target;
+            latest = target;
+            coverage::clear();
+            crash_handler::arm(input.empty() ? empty_input : input.data(), input.size());
+            try
+            {
+                target->fuzz(input.empty() ? empty_input : input.data(), input.size());
+            }
+            catch (const std::exception& exception)
+            {
+                target->errors++;
+                target->first_failure = fmt::format("exception: {}", exception.what());
+            }
+            catch (...)
+            {
+                target->errors++;
+                target->first_failure = "unknown exception";
+            }
+            crash_handler::disarm();
+            target->join_thread_counts();
+            return target->errors == 0;
+        };
+
+        std::vector<std::vector<std::uint8_t>> corpus;
+        for (const auto& file: corpus_files(*target))
+        {
+            const mapped_file input(file);
+            corpus.emplace_back(input.data, input.data + input.size);
+        }
+        if (corpus.empty())
+            corpus.emplace_back();
+
+        mutator mutator { .max_length = std::max<std::size_t>(1, config.fuzz_max_length) };
+        crash_handler::start(directory);
+        const auto start = std::chrono::steady_clock::now();
+        auto next_status = start + std::chrono::seconds(1);
+        std::uint64_t runs = 0;
+        const std::vector<std::uint8_t>* failing = nullptr;
+        std::vector<std::uint8_t> input;
+
+        const auto print_status = [&](const char* event)
+        {
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            fmt::println(config.output, "-- #{} {} edges: {} corpus: {} exec/s: {:.0f}"
+                , runs, event, coverage::edges(seen), corpus.size(), elapsed > 0 ? double(runs) / elapsed : 0.0);
+            std::fflush(config.output);
+        };
+
+        for (const auto& seed: corpus)
+        {
+            runs++;
+            if (!execute(seed))
+            {
+                failing = &seed;
+                break;
+            }
+            coverage::merge(seen);
+        }
+        if (!failing)
+            print_status("seeded");
+
+        while (!failing)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if ((config.fuzz_runs > 0 && runs >= config.fuzz_runs)
+                || (config.fuzz_runs == 0 && now - start >= config.fuzz_time))
+                break;
+            if (now >= next_status)
+            {
+                print_status("pulse");
+                next_status = now + std::chrono::seconds(1);
+            }
+
+            input = corpus[mutator.below(corpus.size())];
+            mutator.mutate(input, corpus);
+            runs++;
+            if (!execute(input))
+            {
+                failing = &input;
+                break;
+            }
+            if (coverage::merge(seen))
+            {
+                corpus.push_back(input);
+                save_input(directory.c_str(), "", input.data(), input.size());
+            }
+        }
+        crash_handler::stop();
+        config.verbosity = saved_verbosity;
+
+        if (!failing)
+        {
+            print_status("done");
+            target->reset();
+            suite::current = nullptr;
+            return 0;
+        }
+
+        const std::vector<std::uint8_t> failure = *failing;
+        save_input(directory.c_str(), "failure-", failure.data(), failure.size());
+        print_status("failed");
+        fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red)
+            , "-- failing input saved as {}", (directory / fmt::format("failure-{:016x}", fnv1a(failure.data(), failure.size()))).string()));
+
+        target->setup();
+        execute(failure);
+        if (!target->printed_something && config.verbosity > verbosity::quiet)
+        {
+            // Exceptions and crashes are not reported by any assertion
+            fmt::println(config.output, "\n\t{}", target->first_failure);
+            target->printed_something = true;
+        }
+        target->teardown();
+        target->reset();
+        suite::current = nullptr;
+        return 1;
+    }
+
+    // ---------------------------------------- ARGUMENTS
+
+    namespace
+    {
+        struct arguments
+        {
+            bool list_only = false;
+            std::filesystem::path serve_path = {};
+            std::string fuzz_target = {};
+        };
+
+        arguments parse_arguments(session& session, int argc, char** argv)
+        {
+            arguments result;
+            for (int i = 0; i < argc; i++)
+            {
+                if ((!strcmp(argv[i], "--verbosity") || !strcmp(argv[i], "-v")) && i + 1 < argc)
+                {
+                    i++;
+                    if (!strcmp(argv[i], "silent")) { session.config.verbosity = verbosity::silent; }
+                    if (!strcmp(argv[i], "quiet")) { session.config.verbosity = verbosity::quiet; }
+                    if (!strcmp(argv[i], "failures")) { session.config.verbosity = verbosity::failures; }
+                    if (!strcmp(argv[i], "passed")) { session.config.verbosity = verbosity::passed; }
+                    if (!strcmp(argv[i], "everything")) { session.config.verbosity = verbosity::everything; }
+                }
+
+                if ((!strcmp(argv[i], "--source_root") || !strcmp(argv[i], "-s")) && i + 1 < argc)
+                {
+                    i++;
+                    session.config.source_root = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.profile_root = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--profile_frequency") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.profile_frequency = std::atoi(argv[i]);
+                }
+
+                if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.trace_path = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--journal") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.journal_path = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--resume") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.resume_path = argv[i];
+                }
+
+                if ((!strcmp(argv[i], "--filter") || !strcmp(argv[i], "-f")) && i + 1 < argc)
+                {
+                    i++;
+                    std::string_view patterns = argv[i];
+                    for (std::size_t comma; (comma = patterns.find(',')) != std::string_view::npos; patterns.remove_prefix(comma + 1))
+                        session.config.filters.emplace_back(patterns.substr(0, comma));
+                    session.config.filters.emplace_back(patterns);
+                }
+
+                if ((!strcmp(argv[i], "--tags") || !strcmp(argv[i], "-t")) && i + 1 < argc)
+                {
+                    i++;
+                    for (const auto tag: split_list(argv[i]))
+                        session.config.tags.emplace_back(tag);
+                }
+
+                if (!strcmp(argv[i], "--max_failures") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.max_failures = std::atoi(argv[i]);
+                }
+
+                if (!strcmp(argv[i], "--hotspots"))
+                {
+                    session.config.hotspots = true;
+                }
+
+                if (!strcmp(argv[i], "--corpus") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.corpus_root = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--fuzz") && i + 1 < argc)
+                {
+                    i++;
+                    result.fuzz_target = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--fuzz_time") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.fuzz_time = std::chrono::seconds(std::atoi(argv[i]));
+                }
+
+                if (!strcmp(argv[i], "--fuzz_runs") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.fuzz_runs = std::strtoull(argv[i], nullptr, 10);
+                }
+
+                if (!strcmp(argv[i], "--fuzz_max_length") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.fuzz_max_length = std::strtoull(argv[i], nullptr, 10);
+                }
+
+                if (!strcmp(argv[i], "--temp_root") && i + 1 < argc)
+                {
+                    i++;
+                    session.config.temp_root = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--keep_temp"))
+                {
+                    session.config.keep_temp = true;
+                }
+
+                if (!strcmp(argv[i], "--capture"))
+                {
+                    session.config.capture = true;
+                }
+
+                if (!strcmp(argv[i], "--list"))
+                {
+                    result.list_only = true;
+                }
+
+                if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+                {
+                    i++;
+                    result.serve_path = argv[i];
+                }
+
+                if (!strcmp(argv[i], "--load") && i + 1 < argc)
+                {
+                    i++;
+                    session.load(argv[i]);
+                }
+
+                if (!strcmp(argv[i], "--unload") && i + 1 < argc)
+                {
+                    i++;
+                    session.unload(argv[i]);
+                }
+            }
+            return result;
+        }
+    }
+
+    // ---------------------------------------- SERVER
+
+    int session::serve(const std::filesystem::path& socket_path)
+    {
+#ifdef UTEST_POSIX
+        // Each connection sends one line of arguments (as on the command line,
+        // "quit" stops the server) and receives the output of the run, followed
+        // by "-> exit <code>". Fixtures, and whatever state the test executable
+        // built so far, stay alive between requests; what the fixtures print
+        // themselves still goes to the standard output
+        static constexpr timeval request_timeout = { 5, 0 };
+
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.native().size() >= sizeof(address.sun_path))
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- socket path too long: {}", socket_path.string()));
+            return 1;
+        }
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.native().size());
+
+        // Only a socket left behind by a previous server is replaced
+        struct stat existing;
+        if (lstat(address.sun_path, &existing) == 0 && S_ISSOCK(existing.st_mode))
+            unlink(address.sun_path);
+
+        const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server < 0 || bind(server, (const sockaddr*)&address, sizeof(address)) != 0 || listen(server, 8) != 0)
+        {
+            fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- could not listen on {}: {}", socket_path.string(), std::strerror(errno)));
+            if (server >= 0)
+                close(server);
+            return 1;
+        }
+
+        // A client going away in the middle of a run must not kill the server
+        std::signal(SIGPIPE, SIG_IGN);
+        fmt::println(config.output, "-- serving on {}", socket_path.string());
+        std::fflush(config.output);
+
+        const options saved = config;
+
+        bool running = true;
+        while (running)
+        {
+            const int client = accept(server, nullptr, nullptr);
+            if (client < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            // Requests are served one at a time, a client that doesn't send its
+            // line in time is dropped rather than hold the others back
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &request_timeout, sizeof(request_timeout));
+            std::string request;
+            char c;
+            ssize_t received = 0;
+            while (request.size() < (1 << 16) && (received = read(client, &c, 1)) == 1 && c != '\n')
+                request += c;
+            if (received < 0)
+            {
+                close(client);
+                continue;
+            }
+
+            std::vector<std::string> tokens = { "serve" };
+            std::string_view rest = request;
+            while (!rest.empty())
+            {
+                const auto begin = rest.find_first_not_of(" \t\r");
+                if (begin == std::string_view::npos)
+                    break;
+                rest.remove_prefix(begin);
+                const auto end = std::min(rest.find_first_of(" \t\r"), rest.size());
+                tokens.emplace_back(rest.substr(0, end));
+                rest.remove_prefix(end);
+            }
+
+            if (tokens.size() == 2 && tokens[1] == "quit")
+            {
+                running = false;
+                close(client);
+                continue;
+            }
+
+            config.output = fdopen(client, "w");
+            if (!config.output)
+            {
+                close(client);
+                config = saved;
+                continue;
+            }
+
+            std::vector<char*> argv;
+            for (auto& token: tokens)
+                argv.push_back(token.data());
+            const auto args = parse_arguments(*this, int(argv.size()), argv.data());
+            int result = 0;
+            if (args.list_only)
+            {
+                result = list();
+            }
+            else
+            {
+                for (auto fixture: fixtures)
+                    fixture->reset();
+                result = runall();
+            }
+            fmt::println(config.output, "-> exit {}", result);
+            std::fclose(config.output);
+            config = saved;
+        }
+
+        close(server);
+        unlink(address.sun_path);
+        return 0;
+#else
+        fmt::println(config.output, "{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- --serve is not supported on this platform ({})", socket_path.string()));
+        return 1;
+#endif
+    }
+
+    // ---------------------------------------- ENTRY POINT
+
+    int session::run(int argc, char** argv)
+    {
+        const auto args = parse_arguments(*this, argc, argv);
+        if (!args.serve_path.empty())
+            return serve(args.serve_path);
+        if (!args.fuzz_target.empty())
+            return fuzz(args.fuzz_target);
+        return args.list_only ? list() : runall();
+    }
+}
+
+#ifdef UTEST_FUZZ
+// Called by the code built with -fsanitize-coverage=trace-pc-guard (clang) or
+// -fsanitize-coverage=trace-pc (GCC), utest itself must not be instrumented
+extern "C" void __sanitizer_cov_trace_pc_guard_init(std::uint32_t* start, std::uint32_t* stop)
+{
+    using utest::coverage;
+    for (std::uint32_t* guard = start; guard < stop; guard++)
+    {
+        if (*guard == 0)
+            *guard = coverage::guards < coverage::capacity - 1 ? ++coverage::guards : std::uint32_t(coverage::capacity - 1);
+    }
+}
+
+extern "C" void __sanitizer_cov_trace_pc_guard(std::uint32_t* guard)
+{
+    // Saturated, a hot edge wrapping around would look new or vanish
+    std::uint8_t& counter = utest::coverage::counters[*guard];
+    counter += counter != 255;
+}
+
+extern "C" void __sanitizer_cov_trace_pc()
+{
+    // Without guards, program counters are hashed into the first 64K counters
+    using utest::coverage;
+    static constexpr std::uint32_t size = std::min<std::uint32_t>(1 << 16, coverage::capacity);
+    const auto pc = reinterpret_cast<std::uintptr_t>(__builtin_return_address(0));
+    std::uint8_t& counter = coverage::counters[((pc >> 4) ^ (pc >> 20)) % size];
+    counter += counter != 255;
+    coverage::guards = std::max(coverage::guards, size - 1);
+}
+#endif
@@ -1,17 +1,45 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
+#include <limits>
 #include <string>
 #include <vector>
 #include <array>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <concepts>
+#include <type_traits>
 #include <filesystem>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 
 // ------------------------------------------ HELPER MACROS
 
 #define STR2(x) #x
 #define STR(x) STR2(x)
 
+// Reporting is kept out of the way of the code under test
+#if defined(__GNUC__)
+#define UTEST_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define UTEST_COLD __declspec(noinline)
+#else
+#define UTEST_COLD
+#endif
+
+// Marks an executable as a suite answering --list: utest_runner only runs the
+// binaries it discovers in directories when they carry it (utest::main does)
+#define UTEST_HANDSHAKE_TEXT "utest-suite-handshake/1"
+#if defined(__GNUC__)
+#define UTEST_HANDSHAKE() extern "C" __attribute__((used)) const char utest_handshake[] = UTEST_HANDSHAKE_TEXT
+#else
+#define UTEST_HANDSHAKE() extern "C" const char utest_handshake[] = UTEST_HANDSHAKE_TEXT
+#endif
+
 namespace utest
 {
     // ------------------------------------------ CONCEPTS
@@ -39,6 +67,23 @@ namespace utest
         Iter end() const { return last; }
     };
 
+    // Arrays are not strings: they need not be terminated, nor stop at a NUL
+    template <typename String>
+    concept string_like = range_like<String> && !std::is_array_v<String> && std::convertible_to<const String&, std::string_view>;
+
+    // Still printed (and diffed) as text, up to the first NUL within bounds
+    template <typename Array>
+    concept char_array = range_like<Array> && std::is_array_v<Array> && std::same_as<std::remove_cv_t<std::remove_extent_t<Array>>, char>;
+
+    template <typename Text>
+    static constexpr std::string_view text_view(const Text& value)
+    {
+        if constexpr (char_array<Text>)
+            return std::string_view(std::begin(value), std::size_t(std::find(std::begin(value), std::end(value), '\0') - std::begin(value)));
+        else
+            return std::string_view(value);
+    }
+
     template <range_like Range>
     using iterator_type_t = decltype(std::begin(std::declval<Range&>()));
 
@@ -48,8 +93,26 @@ namespace utest
 
     // ------------------------------------------ STRING HELPERS
 
+    // Shell-like pattern, '*' matches any run of characters and '?' any single one
+    bool glob_match(std::string_view pattern, std::string_view text);
+
     template <typename T> inline std::string to_string(const T& value) { return std::to_string(value); }
-    static inline std::string to_string(const char* const value) { return std::string(value); }
+    template <typename Pointer> requires std::is_pointer_v<Pointer> && std::convertible_to<Pointer, const char*>
+    static std::string to_string(const Pointer& value) { return std::string(value); }
+    template <string_like String> static std::string to_string(const String& value) { return std::string(std::string_view(value)); }
+    template <char_array Array>
+    static std::string to_string(const Array& value)
+    {
+        // Whatever follows the first NUL is shown when it is not only padding
+        const std::string_view text = text_view(value);
+        if (std::all_of(std::begin(value) + text.size(), std::end(value), [](char c) { return c == '\0'; }))
+            return std::string(text);
+
+        std::string result;
+        for (const char c: value)
+            result += c == '\0' ? std::string("\\0") : std::string(1, c);
+        return result;
+    }
 
     template <range_like Range>
     static std::string to_string(const Range& range)
@@ -85,7 +148,7 @@ namespace utest
             result += to_string(*it);
             result += sep;
         }
-        if (result.size() > 3)
+        if (!result.empty())
             result.resize(result.size() - sep.size());
         return result;
     }
@@ -102,15 +165,15 @@ namespace utest
         less_equal
     };
 
-    template <typename Left, typename Right> static bool compare_equal(const Left& left, const Right& right) { return left == right; }
-    template <typename Left, typename Right> static bool compare_not_equal(const Left& left, const Right& right) { return left != right; }
-    template <typename Left, typename Right> static bool compare_greater_than(const Left& left, const Right& right) { return left > right; }
-    template <typename Left, typename Right> static bool compare_greater_equal(const Left& left, const Right& right) { return left >= right; }
-    template <typename Left, typename Right> static bool compare_less_than(const Left& left, const Right& right) { return left < right; }
-    template <typename Left, typename Right> static bool compare_less_equal(const Left& left, const Right& right) { return left <= right; }
+    template <typename Left, typename Right> static constexpr bool compare_equal(const Left& left, const Right& right) { return left == right; }
+    template <typename Left, typename Right> static constexpr bool compare_not_equal(const Left& left, const Right& right) { return left != right; }
+    template <typename Left, typename Right> static constexpr bool compare_greater_than(const Left& left, const Right& right) { return left > right; }
+    template <typename Left, typename Right> static constexpr bool compare_greater_equal(const Left& left, const Right& right) { return left >= right; }
+    template <typename Left, typename Right> static constexpr bool compare_less_than(const Left& left, const Right& right) { return left < right; }
+    template <typename Left, typename Right> static constexpr bool compare_less_equal(const Left& left, const Right& right) { return left <= right; }
 
     template <comparison_type Comp, typename Left, typename Right>
-    static bool compare(const Left& left, const Right& right)
+    static constexpr bool compare_values(const Left& left, const Right& right)
     {
         switch (Comp)
         {
@@ -124,8 +187,14 @@ namespace utest
         return false;
     }
 
+    template <comparison_type Comp, typename Left, typename Right>
+    static constexpr bool compare(const Left& left, const Right& right)
+    {
+        return compare_values<Comp>(left, right);
+    }
+
     template <comparison_type Comp, range_like Left, range_like Right>
-    static bool compare(const Left& left, const Right& right)
+    static constexpr bool compare(const Left& left, const Right& right)
     {
         auto l = std::begin(left);
         auto r = std::begin(right);
@@ -147,10 +216,226 @@ namespace utest
         return true;
     }
 
+    template <comparison_type Comp, string_like Left, string_like Right>
+    static constexpr bool compare(const Left& left, const Right& right)
+    {
+        return compare_values<Comp>(std::string_view(left), std::string_view(right));
+    }
+
+    // Against a string, a character array is the text before its first NUL
+    // (e.g. a literal); two arrays compare element-wise as any other ranges
+    template <comparison_type Comp, string_like Left, char_array Right>
+    static constexpr bool compare(const Left& left, const Right& right)
+    {
+        return compare_values<Comp>(std::string_view(left), text_view(right));
+    }
+
+    template <comparison_type Comp, char_array Left, string_like Right>
+    static constexpr bool compare(const Left& left, const Right& right)
+    {
+        return compare_values<Comp>(text_view(left), std::string_view(right));
+    }
+
+    // ------------------------------------------ DIFF
+
+    UTEST_COLD std::string diff(std::string_view left, std::string_view right);
+    UTEST_COLD std::string diff(const std::vector<std::string>& left, const std::vector<std::string>& right);
+
+    // Edit script between both sides of a failed equality, empty when
+    // the operands are not strings or ranges
+    template <comparison_type Comp, typename Left, typename Right>
+    static std::string describe_difference(const Left& left, const Right& right)
+    {
+        if constexpr (Comp != comparison_type::equal)
+        {
+            return {};
+        }
+        else if constexpr ((string_like<Left> || char_array<Left>) && (string_like<Right> || char_array<Right>))
+        {
+            // Arrays differing past a NUL only, their values tell it all
+            if (text_view(left) == text_view(right))
+                return {};
+            return diff(text_view(left), text_view(right));
+        }
+        else if constexpr (range_like<Left> && range_like<Right>)
+        {
+            std::vector<std::string> left_items, right_items;
+            for (const auto& item: left)
+                left_items.push_back(to_string(item));
+            for (const auto& item: right)
+                right_items.push_back(to_string(item));
+            return diff(left_items, right_items);
+        }
+        else
+        {
+            return {};
+        }
+    }
+
+    // ------------------------------------------ UNORDERED COMPARISON
+
+    struct unordered_result
+    {
+        bool success = true;
+        std::string details = {};
+    };
+
+    // Multiset equality in O(n): both sides are walked in step, the left side
+    // counting occurrences up in a hash map and the right side counting them down.
+    // Entries are dropped as soon as they balance out, so that the map only holds
+    // the elements not matched so far (none at all for ranges in the same order)
+    template <range_like Left, range_like Right>
+    static unordered_result compare_unordered(const Left& left, const Right& right)
+    {
+        using value_type = std::remove_cvref_t<decltype(*std::begin(left))>;
+        static constexpr std::size_t max_reported = 16;
+
+        std::unordered_map<value_type, std::ptrdiff_t> counts;
+        const auto account = [&](const value_type& item, std::ptrdiff_t delta)
+        {
+            auto it = counts.try_emplace(item, 0).first;
+            if ((it->second += delta) == 0)
+                counts.erase(it);
+        };
+
+        auto l = std::begin(left);
+        auto r = std::begin(right);
+        for (; l != std::end(left) && r != std::end(right); ++l, ++r)
+        {
+            account(*l, 1);
+            account(value_type(*r), -1);
+        }
+        for (; l != std::end(left); ++l)
+            account(*l, 1);
+        for (; r != std::end(right); ++r)
+            account(value_type(*r), -1);
+
+        if (counts.empty())
+            return {};
+
+        std::vector<std::string> missing_from_right, missing_from_left;
+        for (const auto& [item, count]: counts)
+        {
+            auto& missing = count > 0 ? missing_from_right : missing_from_left;
+            missing.push_back(to_string(item) + (count == 1 || count == -1 ? "" : " (x" + std::to_string(count > 0 ? count : -count) + ")"));
+        }
+
+        unordered_result result { false };
+        const auto report = [&](const char* label, std::vector<std::string>& missing)
+        {
+            if (missing.empty())
+                return;
+            std::sort(missing.begin(), missing.end());
+            const std::size_t shown = std::min(missing.size(), max_reported);
+            result.details += "\t\t" + std::string(label) + ": ";
+            result.details += join(make_range(missing.begin(), missing.begin() + shown));
+            if (shown < missing.size())
+                result.details += ", ... (" + std::to_string(missing.size() - shown) + " more)";
+            result.details += "\n";
+        };
+        report("missing from right", missing_from_right);
+        report("missing from left", missing_from_left);
+        result.details.pop_back();
+        return result;
+    }
+
+    // ------------------------------------------ BULK PREDICATES
+
+    struct bulk_result
+    {
+        bool success = true;
+        std::string left = {};
+        std::string right = {};
+        std::string details = {};
+    };
+
+    // Failures are first counted in a branch-free loop the compiler can vectorize,
+    // the range is only walked again to describe the first failing items
+    template <bool Expected, range_like Range, typename Predicate>
+    static bulk_result check_all(const Range& range, const Predicate& predicate)
+    {
+        static constexpr std::size_t max_reported = 16;
+
+        std::size_t count = 0;
+        std::size_t failures = 0;
+        for (const auto& item: range)
+        {
+            failures += static_cast<bool>(predicate(item)) != Expected;
+            count++;
+        }
+
+        bulk_result result { failures == 0, "(" + std::to_string(count) + " items)", "(" + std::to_string(failures) + " failed)" };
+        if (result.success)
+            return result;
+
+        result.details = "\t\tfirst failing items:";
+        std::size_t index = 0;
+        std::size_t reported = 0;
+        for (auto it = std::begin(range); it != std::end(range) && reported < max_reported; it++, index++)
+        {
+            if (static_cast<bool>(predicate(*it)) == Expected)
+                continue;
+            result.details += "\n\t\t\t[" + std::to_string(index) + "]: " + to_string(*it);
+            reported++;
+        }
+        if (reported < failures)
+            result.details += "\n\t\t\t... and " + std::to_string(failures - reported) + " more";
+        return result;
+    }
+
+    template <range_like Left, range_like Right>
+    static bulk_result check_each_equal(const Left& left, const Right& right)
+    {
+        static constexpr std::size_t max_reported = 16;
+
+        const std::size_t left_size = std::distance(std::begin(left), std::end(left));
+        const std::size_t right_size = std::distance(std::begin(right), std::end(right));
+        const std::size_t size = std::min(left_size, right_size);
+
+        std::size_t failures = 0;
+        if constexpr (std::random_access_iterator<iterator_type_t<const Left>> && std::random_access_iterator<iterator_type_t<const Right>>)
+        {
+            const auto l = std::begin(left);
+            const auto r = std::begin(right);
+            for (std::size_t i = 0; i < size; i++)
+                failures += !compare<comparison_type::equal>(l[i], r[i]);
+        }
+        else
+        {
+            auto l = std::begin(left);
+            auto r = std::begin(right);
+            for (std::size_t i = 0; i < size; i++, l++, r++)
+                failures += !compare<comparison_type::equal>(*l, *r);
+        }
+
+        bulk_result result { failures == 0 && left_size == right_size, "(" + std::to_string(left_size) + " items)", "(" + std::to_string(right_size) + " items)" };
+        if (result.success)
+            return result;
+
+        result.details = "\t\t" + std::to_string(failures) + " mismatching items";
+        if (left_size != right_size)
+            result.details += ", sizes differ";
+
+        std::size_t reported = 0;
+        auto l = std::begin(left);
+        auto r = std::begin(right);
+        for (std::size_t i = 0; i < size && reported < max_reported; i++, l++, r++)
+        {
+            if (compare<comparison_type::equal>(*l, *r))
+                continue;
+            result.details += "\n\t\t\t[" + std::to_string(i) + "]: " + to_string(*l) + " != " + to_string(*r);
+            reported++;
+        }
+        if (reported < failures)
+            result.details += "\n\t\t\t... and " + std::to_string(failures - reported) + " more";
+        return result;
+    }
+
     // ------------------------------------------ TEST SUITE AND CONFIG
 
     enum class verbosity
     {
+        silent,
         quiet,
         failures,
         passed,
@@ -158,107 +443,812 @@ namespace utest
     };
 
     struct fixture;
+    struct session_state;
 
+    // Given to test_define after the name, e.g. ".tags = \"startup,simd\""
+    struct attributes
+    {
+        // Comma separated
+        const char* tags = "";
+
+        // Expected duration, budgeted self-tests skip the heaviest fixtures first
+        std::chrono::microseconds cost = {};
+
+        // Comma separated group.name of the fixtures to pass first, this one is
+        // skipped when one of them fails; ignored when not selected
+        const char* depends = "";
+
+        // Resources held while running, utest_runner keeps their sum within
+        // its limits: cores kept busy, expected peak memory in MiB, and whether
+        // nothing else may run at the same time (benchmarks, fixed ports)
+        int cpus = 1;
+        std::size_t memory = 0;
+        bool exclusive = false;
+    };
+
+    enum class outcome
+    {
+        passed,
+        failed,
+        skipped
+    };
+
+    struct self_test_entry
+    {
+        std::string fixture;
+        outcome result = outcome::skipped;
+        int cases = 0;
+        int errors = 0;
+        std::chrono::microseconds duration = {};
+
+        // First failed assertion as "location: expression"
+        std::string failure = {};
+    };
+
+    struct self_test_result
+    {
+        std::vector<self_test_entry> fixtures = {};
+        int passed = 0;
+        int failed = 0;
+        int skipped = 0;
+        std::chrono::microseconds elapsed = {};
+
+        bool ok() const { return failed == 0; }
+    };
+
+    // Registry, configuration and run state of a test suite. Sessions don't
+    // share anything, independent ones can run concurrently on different threads
+    struct session
+    {
+        struct options
+        {
+            utest::verbosity verbosity = utest::verbosity::failures;
+            std::filesystem::path source_root = {};
+            std::filesystem::path profile_root = {};
+            int profile_frequency = 997;
+            std::filesystem::path trace_path = {};
+            std::filesystem::path journal_path = {};
+            std::filesystem::path resume_path = {};
+            std::vector<std::string> filters = {};
+
+            // Tags a fixture must have, or must not have when prefixed by '!'
+            std::vector<std::string> tags = {};
+            std::FILE* output = stdout;
+
+            // Standard output and error of fixtures are kept apart and only
+            // shown for the ones that failed
+            bool capture = false;
+
+            // Failures of a call site past this many are only counted, 0 for no limit
+            int max_failures = 8;
+
+            // Assertions are accounted per call site, the busiest are listed at the end
+            bool hotspots = false;
+
+            // Inputs of a test_fuzz fixture live in <corpus_root>/<group>.<name>
+            std::filesystem::path corpus_root = "corpus";
+            std::chrono::seconds fuzz_time = std::chrono::seconds(60);
+            std::uint64_t fuzz_runs = 0;
+            std::size_t fuzz_max_length = 4096;
+
+            // Temporary directories go to a tmpfs found by default, those of
+            // failing fixtures are kept on demand
+            std::filesystem::path temp_root = {};
+            bool keep_temp = false;
+        };
+
+        options config = {};
+        std::vector<fixture*> fixtures = {};
+        std::vector<std::pair<std::filesystem::path, void*>> modules = {};
+        std::unique_ptr<session_state> state;
+
+        // Fixture the session started last, for the threads it starts
+        std::atomic<fixture*> latest = nullptr;
+
+        // Fixtures keep a pointer to their session
+        session();
+        session(const session&) = delete;
+        session& operator=(const session&) = delete;
+        ~session();
+
+        // Name filters and tags, after compile_tags() turned the tags of the
+        // options into masks of the tags interned so far
+        bool selected(const fixture& fixture) const;
+        void compile_tags();
+        int list();
+        int runall();
+        int run(int argc, char** argv);
+        int serve(const std::filesystem::path& socket_path);
+        bool load(const std::filesystem::path& module);
+        bool unload(const std::filesystem::path& module);
+        std::string ez_file(const char* filepath) const;
+
+        // Runs the fixtures having the tag (all of them when empty) without
+        // printing anything; cheapest first, fixtures that no longer fit in
+        // the budget are skipped. Exceptions count as failures
+        self_test_result self_test(std::string_view tag, std::chrono::microseconds budget);
+
+        // Mutates the corpus of a test_fuzz fixture, guided by coverage when
+        // the code under test is built with -fsanitize-coverage=trace-pc-guard
+        int fuzz(std::string_view fixture_name);
+    };
+
+    // Static interface, everything but current refers to the default
+    // session which fixtures join unless constructed for another one; the
+    // references are constant initialized, the session is constructed by
+    // the first call to default_session() (e.g. from the first fixture)
     struct suite
     {
         struct config
         {
-            static verbosity verbosity;
-            static std::filesystem::path source_root;
+            static utest::verbosity& verbosity;
+            static std::filesystem::path& source_root;
+            static std::filesystem::path& profile_root;
+            static int& profile_frequency;
+            static std::filesystem::path& trace_path;
+            static std::filesystem::path& journal_path;
+            static std::filesystem::path& resume_path;
+            static std::vector<std::string>& filters;
+            static std::vector<std::string>& tags;
+            static bool& capture;
+            static int& max_failures;
+            static bool& hotspots;
+            static std::filesystem::path& corpus_root;
+            static std::chrono::seconds& fuzz_time;
+            static std::uint64_t& fuzz_runs;
+            static std::size_t& fuzz_max_length;
+            static std::filesystem::path& temp_root;
+            static bool& keep_temp;
         };
 
-        static std::vector<fixture*> fixtures;
-        static fixture* current;
+        static std::vector<fixture*>& fixtures;
+
+        // Fixture running on this thread. Assertions made on threads without
+        // one (started by the fixture) go to the latest fixture of the only
+        // session running; with several sessions running such threads say
+        // which fixture they work for with a thread_scope
+        static inline thread_local fixture* current = nullptr;
+        // Whether current was given by a thread_scope, not run on this thread
+        static inline thread_local bool scoped = false;
 
-        static int runall();
-        static int run(int argc, char** argv);
+        static fixture* current_fixture() { return current ? current : unscoped_fixture(); }
+        UTEST_COLD static fixture* unscoped_fixture();
+
+        static session& default_session();
+        static bool selected(const fixture& fixture) { return default_session().selected(fixture); }
+        static int list() { return default_session().list(); }
+        static int runall() { return default_session().runall(); }
+        static int run(int argc, char** argv) { return default_session().run(argc, argv); }
+        static int serve(const std::filesystem::path& socket_path) { return default_session().serve(socket_path); }
+        static bool load(const std::filesystem::path& module) { return default_session().load(module); }
+        static bool unload(const std::filesystem::path& module) { return default_session().unload(module); }
+        static self_test_result self_test(std::string_view tag, std::chrono::microseconds budget) { return default_session().self_test(tag, budget); }
+        static int fuzz(std::string_view fixture_name) { return default_session().fuzz(fixture_name); }
+
+        // Relative to the source root of the session running on this thread
         static std::string ez_file(const char* filepath);
     };
 
+    // Reports the assertions of this thread to the fixture, e.g. in a thread
+    // started with [fixture = utest::suite::current_fixture()] as capture
+    struct thread_scope
+    {
+        fixture* previous;
+        bool previous_scoped;
+
+        explicit thread_scope(fixture* fixture)
+            : previous(suite::current), previous_scoped(suite::scoped)
+        {
+            suite::current = fixture;
+            suite::scoped = true;
+        }
+        thread_scope(const thread_scope&) = delete;
+        thread_scope& operator=(const thread_scope&) = delete;
+        ~thread_scope()
+        {
+            suite::current = previous;
+            suite::scoped = previous_scoped;
+        }
+    };
+
+    // ------------------------------------------ JOURNAL
+
+    // What a (possibly interrupted) run recorded about one fixture,
+    // a fixture that started without finishing is the one that crashed
+    struct journal_entry
+    {
+        std::string fixture;
+        bool finished = false;
+        int cases = 0;
+        int errors = 0;
+        std::chrono::microseconds duration = {};
+        std::vector<std::string> failures = {};
+    };
+
+    struct journal
+    {
+        static std::vector<journal_entry> read(const std::filesystem::path& path);
+    };
+
     // ------------------------------------------ BASE TEST DEFINITION
 
     struct fixture
     {
+        // Sections form a tree interned by (parent, name), nodes are never
+        // removed so ids and display paths stay valid for the fixture lifetime
+        struct section_node
+        {
+            std::string name;
+            int parent = -1;
+            std::string path = {};
+            std::unordered_map<std::string_view, int> children = {};
+            int passed = 0;
+            int failed = 0;
+            std::chrono::steady_clock::duration time = {};
+        };
+
         struct
         {
-            std::array<const char*, 32> names = { "main" };
+            std::deque<section_node> nodes = { { "main" } };
+            std::vector<std::pair<int, std::chrono::steady_clock::time_point>> stack = {};
             int current = 0;
+            // The node of current, spares passing cases an index into the deque
+            section_node* node = &nodes.front();
         } sections;
 
         mutable bool section_changed = true;
+
+        // Tags of the attributes as bits, interned by the session on first use
+        mutable std::vector<std::uint64_t> tag_bits = {};
+        mutable bool tags_interned = false;
         bool printed_something = false;
         int cases = 0;
         int caseindex = 0;
         int errors = 0;
+
+        // What the threads the fixture starts count, under the session's report
+        // lock: its own counts stay plain for its own thread's passing cases
+        struct
+        {
+            int cases = 0;
+            int caseindex = 0;
+            int errors = 0;
+            std::vector<std::pair<int, int>> sections = {};
+        } from_threads;
+        std::chrono::steady_clock::duration duration = {};
+        std::string first_failure = {};
+        std::filesystem::path temp_path = {};
         fixture* next_test = nullptr;
 
+        struct failure_site
+        {
+            const char* file;
+            int line;
+            int count = 0;
+        };
+
+        // Failing call sites by (file, line), in order of first failure
+        std::vector<failure_site> failure_sites = {};
+        std::map<std::pair<std::uintptr_t, int>, std::size_t> failure_site_index = {};
+
+        session* owner;
+
+        // Joins the default session, or the one loading the module it lives in
         fixture();
+        explicit fixture(session& owner);
+        virtual ~fixture();
 
+        void reset();
         void setup();
         void teardown();
 
+        // Created on first use, see utest::temp_dir
+        std::filesystem::path temp_dir();
+        void remove_temp_dir();
+
         void push_section(const char* name);
         void pop_section();
         void add_case();
+        void add_passed()
+        {
+            if (!on_own_thread())
+                return add_passed_from_thread();
+            cases++;
+            caseindex++;
+            sections.node->passed++;
+        }
+        void add_passed_from_thread();
+        // Under the report lock, into from_threads when not on the fixture's thread
+        void count_result(bool success);
+        bool on_own_thread() const { return suite::current == this && !suite::scoped; }
+        // Once the threads the fixture started are joined
+        void join_thread_counts();
+        int failures() const;
+        bool prints_passed() const { return owner->config.verbosity >= verbosity::passed; }
+
+        // Counts a failure of the call site, past the limit it is accounted
+        // for here and true tells the caller to skip reporting it
+        UTEST_COLD bool count_repeated_failure(const char* file, int line);
+        UTEST_COLD void record_hotspot(const char* file, int line, bool failed, std::chrono::steady_clock::duration time);
 
-        void print_section() const;
-        void print_case_header(bool success, const char* location) const;
-        void print_case_expression(const char* op, const char* left, const char* right);
-        void print_case_evaluation(const char* left, const char* right);
+        UTEST_COLD void print_section() const;
+        UTEST_COLD void print_section_summary() const;
+        UTEST_COLD void print_repeated_failures() const;
+        UTEST_COLD void print_case_header(bool success, const char* location) const;
+        UTEST_COLD void print_case_expression(const char* op, const char* left, const char* right);
+        UTEST_COLD void print_case_evaluation(const char* left, const char* right, bool truncate);
+        UTEST_COLD void print_case_details(const char* details);
+        UTEST_COLD void print_captured(std::string_view captured);
 
-        void add_result(
+        UTEST_COLD void add_result(
               bool success
             , const char* location
             , const char* op
             , const char* left_expression, const char* right_expression
-            , const char* left_evaluated, const char* right_evaluated);
+            , const char* left_evaluated, const char* right_evaluated
+            , const char* details = "");
 
         virtual const char* name() const = 0;
         virtual const char* group() const = 0;
+        virtual const utest::attributes& attributes() const { static constexpr utest::attributes none; return none; }
         virtual void run() = 0;
     };
 
+    // ------------------------------------------ TEMPORARY DIRECTORIES
+
+    // Private to the running fixture (or replay thread of a fuzz fixture),
+    // on tmpfs when there is one and removed at teardown; without a fixture
+    // every call creates a new directory left to the caller
+    std::filesystem::path temp_dir();
+
+    // ------------------------------------------ FUZZ FIXTURE
+
+    // Runs its harness over every input of its corpus, in parallel: the
+    // harness must not share state between calls
+    struct fuzz_fixture : fixture
+    {
+        using fixture::fixture;
+
+        virtual void fuzz(const std::uint8_t* data, std::size_t size) = 0;
+        void run() override;
+    };
+
+    // ------------------------------------------ CONSTANT EVALUATION
+
+    // Deliberately not constexpr: reaching it while a test_constexpr body is
+    // constant evaluated fails the build, the diagnostic points at the assertion
+    void constexpr_assertion_failed(const char* expression);
+
+    // Accounts for the compile-time verification of a test_constexpr fixture
+    UTEST_COLD void constexpr_verified(const char* file, int line);
+
+    // ------------------------------------------ HOTSPOTS
+
+    // Measures what an assertion costs once its operands are compared (for
+    // test_unordered_eq and bulk assertions, the whole of it) with --hotspots,
+    // failed when the fixture got more errors meanwhile. Assertions only hold
+    // one when built with UTEST_HOTSPOTS, they cost nothing more otherwise
+    struct hotspot_scope
+    {
+        fixture* current = nullptr;
+        const char* file;
+        int line;
+        int errors = 0;
+        std::chrono::steady_clock::time_point start = {};
+
+        constexpr hotspot_scope(const char* file, int line)
+            : file(file)
+            , line(line)
+        {
+            if (!std::is_constant_evaluated())
+                begin();
+        }
+
+        constexpr ~hotspot_scope()
+        {
+            if (!std::is_constant_evaluated() && current)
+                end();
+        }
+
+        void begin();
+        void end();
+    };
+
+    inline void hotspot_scope::begin()
+    {
+        fixture* fixture = suite::current_fixture();
+        if (fixture && fixture->owner->config.hotspots)
+        {
+            current = fixture;
+            errors = fixture->failures();
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    inline void hotspot_scope::end()
+    {
+        current->record_hotspot(file, line, current->failures() > errors, std::chrono::steady_clock::now() - start);
+    }
+
+    // ------------------------------------------ EXPRESSION DECOMPOSITION
+
+    static constexpr const char* comparison_symbol(comparison_type comp)
+    {
+        switch (comp)
+        {
+            case comparison_type::equal: return "==";
+            case comparison_type::not_equal: return "!=";
+            case comparison_type::greater_than: return ">";
+            case comparison_type::greater_equal: return ">=";
+            case comparison_type::less_than: return "<";
+            case comparison_type::less_equal: return "<=";
+        }
+        return "?";
+    }
+
+    // Operands are held by reference, test_check evaluates and reports within
+    // a single full expression so temporaries outlive the decomposition
+    template <comparison_type Comp, typename Left, typename Right>
+    struct binary_expression
+    {
+        const Left& left;
+        const Right& right;
+        const bool result;
+
+        constexpr explicit operator bool() const { return result; }
+    };
+
+    // Bitwise operators bind looser than comparisons, "a & b" is decomposed as
+    // "(decomposer() <= a) & b" and folded into an operand owning the result
+    template <typename Left, typename Value = const Left&>
+    struct operand
+    {
+        Value value;
+
+        template <typename Right> constexpr binary_expression<comparison_type::equal, Left, Right> operator==(const Right& right) const { return { value, right, compare<comparison_type::equal>(value, right) }; }
+        template <typename Right> constexpr binary_expression<comparison_type::not_equal, Left, Right> operator!=(const Right& right) const { return { value, right, compare<comparison_type::not_equal>(value, right) }; }
+        template <typename Right> constexpr binary_expression<comparison_type::greater_than, Left, Right> operator>(const Right& right) const { return { value, right, compare<comparison_type::greater_than>(value, right) }; }
+        template <typename Right> constexpr binary_expression<comparison_type::greater_equal, Left, Right> operator>=(const Right& right) const { return { value, right, compare<comparison_type::greater_equal>(value, right) }; }
+        template <typename Right> constexpr binary_expression<comparison_type::less_than, Left, Right> operator<(const Right& right) const { return { value, right, compare<comparison_type::less_than>(value, right) }; }
+        template <typename Right> constexpr binary_expression<comparison_type::less_equal, Left, Right> operator<=(const Right& right) const { return { value, right, compare<comparison_type::less_equal>(value, right) }; }
+
+        template <typename Right> constexpr auto operator&(const Right& right) const { return operand<decltype(value & right), decltype(value & right)> { value & right }; }
+        template <typename Right> constexpr auto operator|(const Right& right) const { return operand<decltype(value | right), decltype(value | right)> { value | right }; }
+        template <typename Right> constexpr auto operator^(const Right& right) const { return operand<decltype(value ^ right), decltype(value ^ right)> { value ^ right }; }
+
+        constexpr explicit operator bool() const { return static_cast<bool>(value); }
+    };
+
+    // "decomposer() <= a == b" binds as "(decomposer() <= a) == b", capturing the
+    // top-level comparison; anything of lower precedence (&&, ||, ?:) collapses
+    // into a plain bool and keeps its short-circuit semantics
+    struct decomposer
+    {
+        template <typename Left> constexpr operand<Left> operator<=(const Left& left) const { return { left }; }
+    };
+
+    template <comparison_type Comp, typename Left, typename Right>
+    UTEST_COLD static void report_check(fixture& fixture, const binary_expression<Comp, Left, Right>& expression, const char* text, const char* file, int line)
+    {
+        fixture.add_case();
+        if (!expression.result && fixture.count_repeated_failure(file, line))
+            return;
+        fixture.add_result(
+              expression.result
+            , (suite::ez_file(file) + ":" + std::to_string(line)).c_str()
+            , comparison_symbol(Comp), text, nullptr
+            , ("(" + to_string(expression.left) + ")").c_str(), ("(" + to_string(expression.right) + ")").c_str()
+            , expression.result ? "" : describe_difference<Comp>(expression.left, expression.right).c_str()
+        );
+    }
+
+    template <typename Value>
+    UTEST_COLD static void report_check(fixture& fixture, const Value& value, const char* text, const char* file, int line)
+    {
+        const bool result = static_cast<bool>(value);
+        fixture.add_case();
+        if (!result && fixture.count_repeated_failure(file, line))
+            return;
+        fixture.add_result(
+              result
+            , (suite::ez_file(file) + ":" + std::to_string(line)).c_str()
+            , "", text, nullptr
+            , result ? "(true)" : "(false)", nullptr
+        );
+    }
+
+    template <typename Expression>
+    static constexpr void check(const Expression& expression, const char* text, const char* file, int line)
+    {
+        if (std::is_constant_evaluated())
+        {
+            if (!static_cast<bool>(expression))
+                constexpr_assertion_failed(text);
+            return;
+        }
+
+        // Passing cases that won't be printed only need to be counted
+#if defined(UTEST_HOTSPOTS)
+        const hotspot_scope hotspot(file, line);
+#endif
+        fixture& fixture = *suite::current_fixture();
+        if (static_cast<bool>(expression) && !fixture.prints_passed())
+        {
+            fixture.add_passed();
+            return;
+        }
+        report_check(fixture, expression, text, file, line);
+    }
+
+
+
+    // ------------------------------------------ SAMPLED CHECKS
+
+    // Call site of test_sampled, registered (and given an id) the first time
+    // it is sampled; constant initialized so the static costs no guard
+    struct sampled_site
+    {
+        const char* file;
+        int line;
+        const char* expression;
+        std::atomic<std::uint64_t> evaluated = 0;
+        std::atomic<std::uint64_t> failed = 0;
+        std::atomic<bool> registered = false;
+        std::uint32_t id = 0;
+        sampled_site* next = nullptr;
+    };
+
+    struct sampled_failure
+    {
+        std::uint32_t site;
+        std::uint64_t sequence;
+        std::chrono::system_clock::time_point time;
+        std::string left;
+        std::string right;
+    };
+
+    struct sampled_counters
+    {
+        std::uint32_t id;
+        const char* file;
+        int line;
+        const char* expression;
+        std::uint64_t evaluated;
+        std::uint64_t failed;
+    };
+
+    struct sampling
+    {
+        // Sites of unloaded modules must not be read, keep such modules loaded
+        static std::vector<sampled_counters> sites();
+
+        // Most recent failures still in the ring buffer, oldest first
+        static std::vector<sampled_failure> failures();
+        static std::uint64_t dropped();
+
+        // Counters in the Prometheus text exposition format
+        static std::string metrics();
+    };
+
+    UTEST_COLD void register_sampled_site(sampled_site& site);
+    UTEST_COLD void record_sampled_failure(sampled_site& site, const std::string& left, const std::string& right);
+
+    // Weyl sequence per thread: consecutive states are spread evenly over the
+    // 32 bit range, so "below 2^32 / rate" holds for one call in rate, and the
+    // division folds away for a constant rate
+    inline bool sample(std::uint32_t rate)
+    {
+        static thread_local std::uint32_t state = 0;
+        state += 0x9e3779b9u;
+        return rate <= 1 || state < std::numeric_limits<std::uint32_t>::max() / rate;
+    }
+
+    template <comparison_type Comp, typename Left, typename Right>
+    UTEST_COLD static void report_sampled(sampled_site& site, const binary_expression<Comp, Left, Right>& expression)
+    {
+        record_sampled_failure(site, to_string(expression.left), to_string(expression.right));
+    }
+
+    template <typename Value>
+    UTEST_COLD static void report_sampled(sampled_site& site, const Value&)
+    {
+        record_sampled_failure(site, "false", "");
+    }
+
+    template <typename Expression>
+    static bool check_sampled(sampled_site& site, const Expression& expression)
+    {
+        if (!site.registered.load(std::memory_order_acquire))
+            register_sampled_site(site);
+
+        site.evaluated.fetch_add(1, std::memory_order_relaxed);
+        if (static_cast<bool>(expression))
+            return true;
+        report_sampled(site, expression);
+        return false;
+    }
+
+    // ------------------------------------------ LEAN ASSERTIONS
+
+    // Everything an assertion knows statically, with UTEST_LEAN each test_op
+    // refers to one of these instead of carrying its strings inline
+    struct call_site
+    {
+        const char* file;
+        int line;
+        const char* op;
+        const char* left;
+        const char* right;
+    };
+
+    template <comparison_type Comp, typename Left, typename Right>
+    UTEST_COLD static void report(const call_site* site, bool success, const Left& left, const Right& right)
+    {
+        fixture& fixture = *suite::current_fixture();
+        fixture.add_case();
+        if (!success && fixture.count_repeated_failure(site->file, site->line))
+            return;
+        fixture.add_result(
+              success
+            , (suite::ez_file(site->file) + ":" + std::to_string(site->line)).c_str()
+            , site->op, site->left, site->right
+            , ("(" + to_string(left) + ")").c_str(), ("(" + to_string(right) + ")").c_str()
+            , success ? "" : describe_difference<Comp>(left, right).c_str()
+        );
+    }
+
     // ------------------------------------------ TEST SECTION
 
     struct section
     {
-        section(const char* name);
-        ~section();
-        operator bool() const;
+        constexpr section(const char* name) { if (!std::is_constant_evaluated()) enter(name); }
+        constexpr ~section() { if (!std::is_constant_evaluated()) leave(); }
+        constexpr operator bool() const { return true; }
+
+        static void enter(const char* name);
+        static void leave();
     };
 }
 
 // ------------------------------------------ TEST MACROS, DEFINITION
 
-#define test_define(_group, _name)                                  \
+// Anything after the name initializes the fixture attributes, as in
+// test_define(startup, simd, .tags = "startup", .cost = std::chrono::milliseconds(2))
+#define test_define(_group, _name, ...)                             \
     struct _group ## _ ## _name ## _fixture : utest::fixture        \
     {                                                               \
+        using utest::fixture::fixture;                              \
         void run() override;                                        \
         const char* name() const override { return STR(_name); }    \
         const char* group() const override { return STR(_group); }  \
+        const utest::attributes& attributes() const override        \
+        {                                                           \
+            static const utest::attributes value { __VA_ARGS__ };   \
+            return value;                                           \
+        }                                                           \
     } _group ## _ ## _name ## _fixture_instance;                    \
     void _group ## _ ## _name ## _fixture::run()
 
+// Body is evaluated at compile time, the instantiation of "verified" is
+// deferred until the body has been defined (end of translation unit)
+#define __TEST_CONSTEXPR(_group, _name, _runtime)                                   \
+    template <typename = void>                                                      \
+    struct _group ## _ ## _name ## _fixture : utest::fixture                        \
+    {                                                                               \
+        using utest::fixture::fixture;                                              \
+        static constexpr void body();                                               \
+        static constexpr bool verified = (body(), true);                            \
+        void run() override                                                         \
+        {                                                                           \
+            static_assert(verified);                                                \
+            utest::constexpr_verified(__FILE__, __LINE__);                          \
+            if constexpr (_runtime)                                                 \
+                body();                                                             \
+        }                                                                           \
+        const char* name() const override { return STR(_name); }                    \
+        const char* group() const override { return STR(_group); }                  \
+    };                                                                              \
+    _group ## _ ## _name ## _fixture<> _group ## _ ## _name ## _fixture_instance;   \
+    template <typename T> constexpr void _group ## _ ## _name ## _fixture<T>::body()
+
+// Harness given as test_fuzz(parser, json, const uint8_t* data, size_t size),
+// attributes may follow as with test_define
+#define test_fuzz(_group, _name, _data, _size, ...)                    \
+    struct _group ## _ ## _name ## _fixture : utest::fuzz_fixture       \
+    {                                                                   \
+        using utest::fuzz_fixture::fuzz_fixture;                        \
+        void fuzz(_data, _size) override;                               \
+        const char* name() const override { return STR(_name); }        \
+        const char* group() const override { return STR(_group); }      \
+        const utest::attributes& attributes() const override            \
+        {                                                               \
+            static const utest::attributes value { __VA_ARGS__ };       \
+            return value;                                               \
+        }                                                               \
+    } _group ## _ ## _name ## _fixture_instance;                        \
+    void _group ## _ ## _name ## _fixture::fuzz(_data, _size)
+
+#define test_constexpr(_group, _name) __TEST_CONSTEXPR(_group, _name, false)
+#define test_constexpr_runtime(_group, _name) __TEST_CONSTEXPR(_group, _name, true)
+
 // ------------------------------------------ TEST MACROS, PRIVATE
 
-#define __TEST_CURRENT (*utest::suite::current)
-#define __TEST_BEGIN() { __TEST_CURRENT.add_case()
+#define __TEST_CURRENT (*utest::suite::current_fixture())
+#if defined(UTEST_HOTSPOTS)
+#define __TEST_HOTSPOT() const utest::hotspot_scope __test_hotspot(__FILE__, __LINE__);
+#else
+#define __TEST_HOTSPOT()
+#endif
+#define __TEST_BEGIN() { __TEST_HOTSPOT() __TEST_CURRENT.add_case()
 #define __TEST_STR(value) ("(" + utest::to_string(value) + ")")
 #define __TEST_END() }
 #define __TEST_FILE() utest::suite::ez_file(__FILE__)
 #define __TEST_LOCATION() std::string(__TEST_FILE() + std::string(":" STR(__LINE__)))
+#define __TEST_REPORTED(success) ((success) || !__TEST_CURRENT.count_repeated_failure(__FILE__, __LINE__))
+#define __TEST_CONSTANT_EVALUATION(success, text)                       \
+    if (std::is_constant_evaluated())                                   \
+    {                                                                   \
+        if (!(success))                                                 \
+            utest::constexpr_assertion_failed(text);                    \
+    }                                                                   \
+    else
+
+#if defined(__GNUC__)
+#define __TEST_BEGIN_DECOMPOSE() { _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wparentheses\"")
+#define __TEST_END_DECOMPOSE() _Pragma("GCC diagnostic pop") }
+#else
+#define __TEST_BEGIN_DECOMPOSE() {
+#define __TEST_END_DECOMPOSE() }
+#endif
 
 // ------------------------------------------ TEST MACROS, PUBLIC
 
+#if defined(UTEST_LEAN)
+
+// The call site lives in a lambda since constexpr functions (test_constexpr
+// bodies) may not define static variables
 #define test_op(left, right, opsymbol, opmode)                          \
+    {                                                                   \
+    const bool __test_success = utest::compare<opmode>(left, right);    \
+    __TEST_CONSTANT_EVALUATION(__test_success                           \
+        , STR(left) " " STR(opsymbol) " " STR(right))                   \
+    {                                                                   \
+    __TEST_HOTSPOT()                                                    \
+    utest::fixture& __test_fixture = *utest::suite::current_fixture();  \
+    if (__test_success && !__test_fixture.prints_passed())              \
+        __test_fixture.add_passed();                                    \
+    else                                                                \
+        utest::report<opmode>([]() -> const utest::call_site*           \
+        {                                                               \
+            static constexpr utest::call_site site {                    \
+                __FILE__, __LINE__, STR(opsymbol), STR(left), STR(right) \
+            };                                                          \
+            return &site;                                               \
+        }(), __test_success, left, right);                              \
+    }                                                                   \
+    }
+
+#else
+
+#define test_op(left, right, opsymbol, opmode)                          \
+    {                                                                   \
+    const bool __test_success = utest::compare<opmode>(left, right);    \
+    __TEST_CONSTANT_EVALUATION(__test_success                           \
+        , STR(left) " " STR(opsymbol) " " STR(right))                   \
     __TEST_BEGIN();                                                     \
+    if (__TEST_REPORTED(__test_success))                                \
     __TEST_CURRENT.add_result(                                          \
-          utest::compare<opmode>(left, right)                           \
+          __test_success                                                \
         , __TEST_LOCATION().c_str()                                     \
         , STR(opsymbol), STR(left), STR(right)                          \
         , __TEST_STR(left).c_str(), __TEST_STR(right).c_str()           \
+        , __test_success ? "" :                                         \
+            utest::describe_difference<opmode>(left, right).c_str()     \
     );                                                                  \
-    __TEST_END()
+    __TEST_END()                                                        \
+    }
+
+#endif
 
 #define test_eq(left, right) test_op(left, right, ==, utest::comparison_type::equal)
 #define test_ne(left, right) test_op(left, right, !=, utest::comparison_type::not_equal)
@@ -267,4 +1257,66 @@ namespace utest
 #define test_lt(left, right) test_op(left, right, <, utest::comparison_type::less_than)
 #define test_le(left, right) test_op(left, right, <=, utest::comparison_type::less_equal)
 
+// Both ranges are only printed when the result is, not to undo the
+// bounded memory of the comparison on every passing case
+#define test_unordered_eq(left, right)                                  \
+    {                                                                   \
+    __TEST_HOTSPOT()                                                    \
+    const auto __test_result = utest::compare_unordered(left, right);   \
+    utest::fixture& __test_fixture = __TEST_CURRENT;                    \
+    if (__test_result.success && !__test_fixture.prints_passed())       \
+        __test_fixture.add_passed();                                    \
+    else                                                                \
+    {                                                                   \
+    __test_fixture.add_case();                                          \
+    if (__TEST_REPORTED(__test_result.success))                         \
+    __test_fixture.add_result(                                          \
+          __test_result.success                                         \
+        , __TEST_LOCATION().c_str()                                     \
+        , "unordered ==", STR(left), STR(right)                         \
+        , __TEST_STR(left).c_str(), __TEST_STR(right).c_str()           \
+        , __test_result.details.c_str()                                 \
+    );                                                                  \
+    }                                                                   \
+    }
+
+#define __TEST_BULK(result, op, left_expression, right_expression)     \
+    __TEST_BEGIN();                                                     \
+    const auto __test_result = result;                                  \
+    if (__TEST_REPORTED(__test_result.success))                         \
+    __TEST_CURRENT.add_result(                                          \
+          __test_result.success                                         \
+        , __TEST_LOCATION().c_str()                                     \
+        , op, left_expression, right_expression                         \
+        , __test_result.left.c_str(), __test_result.right.c_str()       \
+        , __test_result.details.c_str()                                 \
+    );                                                                  \
+    __TEST_END()
+
+#define test_all(range, ...) __TEST_BULK(utest::check_all<true>(range, __VA_ARGS__), "all", STR(range), #__VA_ARGS__)
+#define test_none(range, ...) __TEST_BULK(utest::check_all<false>(range, __VA_ARGS__), "none", STR(range), #__VA_ARGS__)
+#define test_each_eq(left, right) __TEST_BULK(utest::check_each_equal(left, right), "each ==", STR(left), STR(right))
+
+// Invariant for production code, evaluated once every rate calls (operands
+// included), returns false when sampled and failed; see utest::sampling
+#define test_sampled(rate, left, op, right)                             \
+    [&]() -> bool                                                       \
+    {                                                                   \
+        static constinit utest::sampled_site __test_site {              \
+            __FILE__, __LINE__, STR(left) " " STR(op) " " STR(right)    \
+        };                                                              \
+        if (!utest::sample(rate))                                       \
+            return true;                                                \
+        __TEST_BEGIN_DECOMPOSE()                                        \
+        return utest::check_sampled(__test_site                         \
+            , utest::decomposer() <= (left) op (right));                \
+        __TEST_END_DECOMPOSE()                                          \
+    }()
+
+#define test_check(...)                                                 \
+    __TEST_BEGIN_DECOMPOSE()                                            \
+    utest::check(utest::decomposer() <= __VA_ARGS__                     \
+        , #__VA_ARGS__, __FILE__, __LINE__);                            \
+    __TEST_END_DECOMPOSE()
+
 #define test_section(name) if (const auto s = utest::section(name))
\ No newline at end of file
@@ -1,6 +1,8 @@
 #define UTEST_DECLARE_MAIN
 #include "utest.h"
 
+UTEST_HANDSHAKE();
+
 int main(int argc, char** argv)
 {
     return utest::suite::run(argc, argv);
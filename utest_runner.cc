@@ -0,0 +1,552 @@
+#include "utest.h"
+
+#include <fmt/format.h>
+#include <fmt/color.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// Runs the fixtures of many test executables (linked with utest::main) as
+// individual processes on a pool of workers, longest fixtures first according
+// to the durations recorded by previous runs, each once the fixtures it depends
+// on have passed
+
+namespace utest::runner
+{
+    // ---------------------------------------- CONFIG
+
+    struct config
+    {
+        static inline int jobs = std::max(1u, std::thread::hardware_concurrency());
+        static inline std::string pattern = "*test*";
+        static inline std::filesystem::path history_path = ".utest_history";
+        static inline std::vector<std::string> forwarded = {};
+        static inline std::filesystem::path self = {};
+
+        // Limits of the resources declared by the fixtures running at once,
+        // --jobs cores and the physical memory (MiB) unless given
+        static inline int cpus = 0;
+        static inline std::size_t memory = 0;
+    };
+
+    // ---------------------------------------- PROCESS
+
+    struct process_result
+    {
+        int status = -1;
+        std::string output = {};
+    };
+
+    // Spawns the command with stdout and stderr going to a single pipe
+    // and waits for it to exit
+    static process_result run_process(const std::vector<std::string>& command)
+    {
+        process_result result;
+        int fds[2];
+        if (pipe(fds) != 0)
+            return result;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+        std::vector<char*> argv;
+        for (const auto& arg: command)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid = -1;
+        const int error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (error != 0)
+        {
+            close(fds[0]);
+            result.output = fmt::format("could not run {}: {}\n", command[0], std::strerror(error));
+            return result;
+        }
+
+        char buffer[4096];
+        ssize_t count;
+        while ((count = read(fds[0], buffer, sizeof(buffer))) > 0 || (count < 0 && errno == EINTR))
+        {
+            if (count > 0)
+                result.output.append(buffer, std::size_t(count));
+        }
+        close(fds[0]);
+
+        while (waitpid(pid, &result.status, 0) < 0 && errno == EINTR) {}
+        return result;
+    }
+
+    // ---------------------------------------- JOBS
+
+    struct job
+    {
+        std::string binary;
+        std::string fixture;
+        std::vector<std::string> depends = {};
+        int cpus = 1;
+        std::size_t memory = 0;
+        bool exclusive = false;
+        std::chrono::microseconds estimate = {};
+
+        // Indices of the jobs of the same binary this one waits for
+        std::vector<std::size_t> dependencies = {};
+        bool started = false;
+        bool done = false;
+        std::string skipped = {};
+
+        process_result process = {};
+        journal_entry entry = {};
+
+        bool passed() const { return entry.finished && entry.errors == 0; }
+    };
+
+    static std::string history_key(const job& job) { return job.binary + '\t' + job.fixture; }
+
+    static std::map<std::string, std::chrono::microseconds> read_history()
+    {
+        std::map<std::string, std::chrono::microseconds> history;
+        std::ifstream file(config::history_path);
+        std::string binary, fixture;
+        long long microseconds;
+        while (std::getline(file, binary, '\t') && std::getline(file, fixture, '\t') && file >> microseconds)
+        {
+            history[binary + '\t' + fixture] = std::chrono::microseconds(microseconds);
+            file.ignore(1);
+        }
+        return history;
+    }
+
+    static void write_history(std::map<std::string, std::chrono::microseconds> history, const std::vector<job>& jobs)
+    {
+        for (const auto& job: jobs)
+        {
+            if (job.entry.finished)
+                history[history_key(job)] = job.entry.duration;
+        }
+
+        std::ofstream file(config::history_path);
+        for (const auto& [key, duration]: history)
+            file << key << '\t' << duration.count() << '\n';
+    }
+
+    // Whether the file embeds UTEST_HANDSHAKE_TEXT, read in chunks overlapping
+    // by the length of the text so it is found across chunk boundaries
+    static bool carries_handshake(const std::filesystem::path& path)
+    {
+        constexpr std::string_view handshake = UTEST_HANDSHAKE_TEXT;
+        std::ifstream file(path, std::ios::binary);
+        std::string chunk(1 << 16, '\0');
+        std::size_t kept = 0;
+        while (file)
+        {
+            file.read(chunk.data() + kept, std::streamsize(chunk.size() - kept));
+            const std::size_t size = kept + std::size_t(file.gcount());
+            if (std::string_view(chunk.data(), size).find(handshake) != std::string_view::npos)
+                return true;
+            kept = std::min(size, handshake.size() - 1);
+            std::memmove(chunk.data(), chunk.data() + size - kept, kept);
+        }
+        return false;
+    }
+
+    // Explicitly named binaries are run as given, those found in directories
+    // must match the pattern and carry the handshake, so that scripts and
+    // helper tools named like tests (this runner included) are left alone
+    static std::vector<std::string> discover(const std::vector<std::string>& paths)
+    {
+        std::vector<std::string> binaries;
+        const auto consider = [&](const std::filesystem::directory_entry& entry)
+        {
+            std::error_code error;
+            const auto permissions = entry.status(error).permissions();
+            if (entry.is_regular_file(error)
+                && (permissions & std::filesystem::perms::owner_exec) != std::filesystem::perms::none
+                && glob_match(config::pattern, entry.path().filename().string())
+                && !std::filesystem::equivalent(entry.path(), config::self, error)
+                && carries_handshake(entry.path()))
+            {
+                binaries.push_back(std::filesystem::canonical(entry.path()).string());
+            }
+        };
+
+        for (const auto& path: paths)
+        {
+            if (std::filesystem::is_directory(path))
+            {
+                for (const auto& entry: std::filesystem::recursive_directory_iterator(path, std::filesystem::directory_options::skip_permission_denied))
+                    consider(entry);
+            }
+            else if (std::filesystem::exists(path))
+            {
+                binaries.push_back(std::filesystem::canonical(path).string());
+            }
+        }
+        std::sort(binaries.begin(), binaries.end());
+        binaries.erase(std::unique(binaries.begin(), binaries.end()), binaries.end());
+        return binaries;
+    }
+
+    static std::vector<job> collect_jobs(const std::vector<std::string>& binaries, const std::map<std::string, std::chrono::microseconds>& history, std::vector<std::string>& unlisted)
+    {
+        std::vector<job> jobs;
+        for (const auto& binary: binaries)
+        {
+            std::vector<std::string> command = { binary, "--list" };
+            command.insert(command.end(), config::forwarded.begin(), config::forwarded.end());
+            const auto listing = run_process(command);
+            if (!WIFEXITED(listing.status) || WEXITSTATUS(listing.status) != 0)
+            {
+                // e.g. a dependency cycle, as explained by the binary
+                fmt::println("{}", fmt::format(fmt::fg(fmt::terminal_color::yellow), "-- could not list fixtures of {}", binary));
+                fmt::print("{}", listing.output);
+                unlisted.push_back(binary);
+                continue;
+            }
+
+            // One fixture per line, followed by tab separated attributes
+            std::string_view lines = listing.output;
+            for (std::size_t end; (end = lines.find('\n')) != std::string_view::npos; lines.remove_prefix(end + 1))
+            {
+                std::string_view line = lines.substr(0, end);
+                if (line.empty())
+                    continue;
+
+                const std::size_t tab = std::min(line.find('\t'), line.size());
+                auto& job = jobs.emplace_back(utest::runner::job { binary, std::string(line.substr(0, tab)) });
+                line.remove_prefix(tab);
+                while (!line.empty())
+                {
+                    line.remove_prefix(1);
+                    const std::size_t next = std::min(line.find('\t'), line.size());
+                    const auto field = line.substr(0, next);
+                    const std::string value(field.substr(std::min(field.find('=') + 1, field.size())));
+                    if (field.starts_with("depends="))
+                    {
+                        std::string_view names = value;
+                        for (std::size_t comma; (comma = names.find(',')) != std::string_view::npos; names.remove_prefix(comma + 1))
+                            job.depends.emplace_back(names.substr(0, comma));
+                        job.depends.emplace_back(names);
+                    }
+                    else if (field.starts_with("cpus="))
+                    {
+                        job.cpus = std::max(0, std::atoi(value.c_str()));
+                    }
+                    else if (field.starts_with("memory="))
+                    {
+                        job.memory = std::strtoull(value.c_str(), nullptr, 10);
+                    }
+                    else if (field.starts_with("exclusive="))
+                    {
+                        job.exclusive = value == "1";
+                    }
+                    line.remove_prefix(next);
+                }
+            }
+        }
+
+        // Unknown fixtures are assumed to be as long as the longest known one,
+        // so they don't end up last and stretch the whole run
+        std::chrono::microseconds longest = {};
+        for (auto& job: jobs)
+        {
+            const auto it = history.find(history_key(job));
+            job.estimate = it != history.end() ? it->second : std::chrono::microseconds(-1);
+            longest = std::max(longest, job.estimate);
+        }
+        for (auto& job: jobs)
+        {
+            if (job.estimate.count() < 0)
+                job.estimate = longest;
+        }
+
+        std::stable_sort(jobs.begin(), jobs.end(), [](const job& a, const job& b) { return a.estimate > b.estimate; });
+
+        // Dependencies on fixtures that are not run are not waited for
+        std::map<std::string, std::size_t> indices;
+        for (std::size_t index = 0; index < jobs.size(); index++)
+            indices.emplace(history_key(jobs[index]), index);
+        for (auto& job: jobs)
+        {
+            for (const auto& name: job.depends)
+            {
+                if (const auto it = indices.find(job.binary + '\t' + name); it != indices.end())
+                    job.dependencies.push_back(it->second);
+            }
+        }
+        return jobs;
+    }
+
+    static void run_job(job& job, std::size_t index)
+    {
+        const auto journal_path = std::filesystem::temp_directory_path() / fmt::format("utest_runner_{}_{}.journal", getpid(), index);
+        std::vector<std::string> command = { job.binary, "--filter", job.fixture, "--journal", journal_path.string() };
+        command.insert(command.end(), config::forwarded.begin(), config::forwarded.end());
+
+        job.process = run_process(command);
+        for (auto& entry: journal::read(journal_path))
+        {
+            if (entry.fixture == job.fixture)
+                job.entry = std::move(entry);
+        }
+        std::error_code error;
+        std::filesystem::remove(journal_path, error);
+    }
+
+    // ---------------------------------------- RUN
+
+    static int run(const std::vector<std::string>& paths)
+    {
+        const auto history = read_history();
+        std::vector<std::string> unlisted;
+        auto jobs = collect_jobs(discover(paths), history, unlisted);
+
+        // Workers take the longest job whose dependencies are done and whose
+        // resources fit, jobs that depend on one that did not pass are skipped
+        // without running; the binaries reject dependency cycles when listing
+        // their fixtures. A job too big for the limits runs once nothing else
+        // does, as exclusive jobs do: they wait for a gap instead of draining
+        // the pool, which keeps the cores busy meanwhile
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::size_t remaining = jobs.size();
+        int running = 0;
+        int used_cpus = 0;
+        std::size_t used_memory = 0;
+        bool exclusive_running = false;
+        const auto fits = [&](const job& job)
+        {
+            if (running == 0)
+                return true;
+            return !exclusive_running && !job.exclusive
+                && used_cpus + job.cpus <= config::cpus
+                && used_memory + job.memory <= config::memory;
+        };
+        const auto acquire = [&](const job& job)
+        {
+            running++;
+            used_cpus += job.cpus;
+            used_memory += job.memory;
+            exclusive_running = job.exclusive;
+        };
+        const auto release = [&](const job& job)
+        {
+            running--;
+            used_cpus -= job.cpus;
+            used_memory -= job.memory;
+            exclusive_running = false;
+        };
+
+        const auto next_job = [&]() -> job*
+        {
+            for (auto& job: jobs)
+            {
+                if (job.started)
+                    continue;
+
+                bool ready = true;
+                for (const std::size_t dependency: job.dependencies)
+                {
+                    const auto& other = jobs[dependency];
+                    if (other.done && !other.passed())
+                    {
+                        job.skipped = other.fixture;
+                        break;
+                    }
+                    ready = ready && other.done;
+                }
+                if (!job.skipped.empty() || (ready && fits(job)))
+                {
+                    job.started = true;
+                    return &job;
+                }
+            }
+            return nullptr;
+        };
+
+        const auto worker = [&]()
+        {
+            std::unique_lock lock(mutex);
+            while (remaining > 0)
+            {
+                job* const next = next_job();
+                if (!next)
+                {
+                    changed.wait(lock);
+                    continue;
+                }
+
+                auto& job = *next;
+                if (job.skipped.empty())
+                {
+                    acquire(job);
+                    lock.unlock();
+                    run_job(job, std::size_t(&job - jobs.data()));
+                    lock.lock();
+                    release(job);
+                }
+                job.done = true;
+                remaining--;
+                changed.notify_all();
+
+                if (!job.skipped.empty())
+                {
+                    fmt::println("{} -> {} {}"
+                        , fmt::format(fmt::fg(fmt::terminal_color::bright_blue), "-- {}", job.fixture)
+                        , fmt::format(fmt::fg(fmt::terminal_color::yellow), "skipped")
+                        , fmt::format(fmt::fg(fmt::terminal_color::bright_black), "({} did not pass)", job.skipped));
+                    std::fflush(stdout);
+                    continue;
+                }
+
+                fmt::print("{}", job.process.output);
+                if (!job.entry.finished)
+                {
+                    const auto reason = WIFSIGNALED(job.process.status)
+                        ? fmt::format("killed by signal {}", WTERMSIG(job.process.status))
+                        : fmt::format("exited with {}", WEXITSTATUS(job.process.status));
+                    fmt::println("{}", fmt::format(fmt::fg(fmt::terminal_color::bright_red), "-- {} ({}) did not finish: {}"
+                        , job.fixture, std::filesystem::path(job.binary).filename().string(), reason));
+                }
+                std::fflush(stdout);
+            }
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < std::min<int>(config::jobs, int(jobs.size())); i++)
+            workers.emplace_back(worker);
+        for (auto& thread: workers)
+            thread.join();
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        write_history(history, jobs);
+
+        int numcases = 0;
+        int numerrors = 0;
+        std::vector<const job*> failed;
+        std::vector<const job*> skipped;
+        for (const auto& job: jobs)
+        {
+            numcases += job.entry.cases;
+            numerrors += job.entry.errors;
+            if (!job.skipped.empty())
+                skipped.push_back(&job);
+            else if (!job.passed())
+                failed.push_back(&job);
+        }
+
+        fmt::println("--------------------------");
+        fmt::println("-> {} fixtures, {} cases in {:.2f}s on {} workers", jobs.size(), numcases, elapsed, config::jobs);
+        if (!failed.empty())
+        {
+            fmt::print(fmt::fg(fmt::terminal_color::bright_red), "-> some tests have failed: ");
+            for (std::size_t i = 0; i < failed.size(); i++)
+            {
+                const auto& job = *failed[i];
+                if (job.entry.finished)
+                    fmt::print("{} ({})", job.fixture, job.entry.errors);
+                else
+                    fmt::print("{} (crashed)", job.fixture);
+                if (failed.size() > i + 2)
+                    fmt::print(", ");
+                else if (failed.size() > i + 1)
+                    fmt::print(" & ");
+            }
+            fmt::println("");
+        }
+        if (!skipped.empty())
+        {
+            fmt::print(fmt::fg(fmt::terminal_color::yellow), "-> skipped: ");
+            for (std::size_t i = 0; i < skipped.size(); i++)
+                fmt::print("{}{}", i > 0 ? ", " : "", skipped[i]->fixture);
+            fmt::println("");
+        }
+        if (!unlisted.empty())
+        {
+            fmt::print(fmt::fg(fmt::terminal_color::bright_red), "-> could not list: ");
+            for (std::size_t i = 0; i < unlisted.size(); i++)
+                fmt::print("{}{}", i > 0 ? ", " : "", std::filesystem::path(unlisted[i]).filename().string());
+            fmt::println("");
+        }
+        return std::min<int>(int(failed.size() + unlisted.size()), 255);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace utest::runner;
+
+    // The runner embeds the handshake text too, as the text it looks for
+    std::error_code error;
+    config::self = std::filesystem::read_symlink("/proc/self/exe", error);
+    if (error)
+        config::self = argv[0];
+
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j")) && i + 1 < argc)
+        {
+            i++;
+            config::jobs = std::max(1, std::atoi(argv[i]));
+        }
+        else if (!strcmp(argv[i], "--pattern") && i + 1 < argc)
+        {
+            i++;
+            config::pattern = argv[i];
+        }
+        else if (!strcmp(argv[i], "--history") && i + 1 < argc)
+        {
+            i++;
+            config::history_path = argv[i];
+        }
+        else if (!strcmp(argv[i], "--cpus") && i + 1 < argc)
+        {
+            i++;
+            config::cpus = std::max(1, std::atoi(argv[i]));
+        }
+        else if (!strcmp(argv[i], "--memory") && i + 1 < argc)
+        {
+            i++;
+            config::memory = std::strtoull(argv[i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--"))
+        {
+            // Everything after "--" goes to the test executables
+            config::forwarded.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        fmt::println("usage: {} [--jobs N] [--cpus N] [--memory MiB] [--pattern glob] [--history file] <binaries or directories>... [-- test arguments]", argv[0]);
+        return 1;
+    }
+    if (config::cpus == 0)
+        config::cpus = config::jobs;
+    if (config::memory == 0)
+        config::memory = (std::size_t(sysconf(_SC_PHYS_PAGES)) * std::size_t(sysconf(_SC_PAGESIZE))) >> 20;
+    return run(paths);
+}